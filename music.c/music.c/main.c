@@ -6,20 +6,179 @@
     - Shuffle, sort (title/artist/duration)
     - Play simulation (prints and sleeps)
     - Save/load CSV (playlist.csv by default)
-   Compile: gcc -O2 -o playlist_manager playlist_manager.c
+    - Node-local parallel search for very large playlists (bench scan N)
+    - Publish to POSIX shared memory for read-only reader processes
+    - Versioned binary format (*.plb) with per-block CRC32C and footer index
+    - Crash-safe saves (temp + fsync + rename) and an edit journal with
+      configurable fsync policy (always / batched / never)
+    - External-memory sort of CSV files larger than RAM (extsort)
+    - Paged mode: list/search/play/remove on files larger than RAM through a
+      fixed-size buffer pool with CLOCK eviction (paged ...)
+    - Hash-based union / intersect / diff of playlist files
+    - Order-aware compare (patience diff with move detection) and three-way
+      merge of playlist versions
+    - Watch the playlist file (inotify, Linux) and apply external edits
+      incrementally instead of re-loading
+    - Smart playlists: rule-defined, membership kept up to date as tracks
+      are added and removed
+    - Extended metadata (genre, year, track, rating, plays, last played,
+      path) in typed columns beside the tracks, with column-only filters
+    - Play history: recent plays ring, append-only history file, and a
+      maintained most-played heap (recent / top)
+    - "More like this": MinHash signatures with LSH buckets (similar N)
+    - Random samples (Floyd / reservoir) that leave the order alone
+    - Differential fuzz target for the file readers (PLAYLIST_FUZZ)
+    - Performance regression gate: --perfgate BASELINE (median/MAD vs a
+      stored baseline, nonzero exit on regression)
+    - Per-command latency histograms with percentiles (latency)
+    - USDT static tracepoints (provider "playlist") around load, save,
+      search, sort, shuffle, remove and every command, for perf/bpftrace
+    - Timeline tracing: per-thread spans exported as Chrome trace JSON
+      (trace on / trace dump), for chrome://tracing or Perfetto
+    - Memory footprint report and compaction (memory / compact): shrink the
+      track array, pack strings into one block in playlist order, renumber
+      ids; runs by itself once fragmentation passes a threshold
+    - String relayout: track strings rewritten into one block in playlist
+      order after load and on demand (relayout, bench relayout)
+    - Sorts through macro-generated introsorts specialized per key, with
+      the comparison inlined (bench sort against qsort)
+    - Stable linear-time duration sort (counting sort, LSD radix for wide
+      ranges)
+    - Top-N / limited sorted listings by introselect plus a sort of just
+      the winners, without reordering the playlist (top N by, list --sorted-by)
+   Compile: gcc -O2 -pthread -o playlist_manager playlist_manager.c
+   With libnuma: add -DHAVE_LIBNUMA -lnuma
+   Fuzzing (differential, see LLVMFuzzerTestOneInput):
+     libFuzzer: clang -g -O1 -fsanitize=fuzzer,address -DPLAYLIST_FUZZ
+                -DPLAYLIST_FUZZ_NO_MAIN -pthread playlist_manager.c
+     AFL:       afl-clang-fast -DPLAYLIST_FUZZ -pthread playlist_manager.c
+                (reads the file named on the command line, or stdin)
+     Seed corpus: fuzz-seeds/ (a CSV with metadata, and .plb files whose
+                index is damaged: bad CRC, and an offset near 2^64)
 */
 
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <ctype.h>
+#include <limits.h>
 #include <time.h>
 #include <unistd.h> /* sleep */
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <poll.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+/* libnuma is opt-in (-DHAVE_LIBNUMA -lnuma): the header alone does not make
+   the plain build link, so it is not detected like <sys/sdt.h> */
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+/* USDT probes, provider "playlist": built in when <sys/sdt.h> (systemtap-sdt-dev)
+   is present, each site a single nop until perf or bpftrace attaches to it.
+   Every probe has a semaphore the tracer raises while attached; durations
+   are only timed (TRACE_CLOCK/TRACE_NS, keyed by the done probe) when it is
+   up, so an untraced run never reads the clock for them. Without the
+   header, or with -DNO_SDT, probes and their arguments compile away.
+   Sizes are counts of tracks, durations nanoseconds. */
+#if defined(__has_include) && !defined(NO_SDT)
+#if __has_include(<sys/sdt.h>)
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+#define HAVE_SDT 1
+#endif
+#endif
+#ifdef HAVE_SDT
+#define TRACE_SEMAPHORE(p) unsigned short playlist_##p##_semaphore __attribute__((unused, section(".probes")))
+TRACE_SEMAPHORE(load__start); TRACE_SEMAPHORE(load__done);
+TRACE_SEMAPHORE(save__start); TRACE_SEMAPHORE(save__done);
+TRACE_SEMAPHORE(search__start); TRACE_SEMAPHORE(search__done);
+TRACE_SEMAPHORE(sort__start); TRACE_SEMAPHORE(sort__done);
+TRACE_SEMAPHORE(shuffle__start); TRACE_SEMAPHORE(shuffle__done);
+TRACE_SEMAPHORE(remove__start); TRACE_SEMAPHORE(remove__done);
+TRACE_SEMAPHORE(cmd__start); TRACE_SEMAPHORE(cmd__done);
+#define TRACE_ENABLED(p) __builtin_expect(playlist_##p##_semaphore != 0, 0)
+/* t0 is 0 when the tracer attached mid-operation; that sample reports 0 */
+#define TRACE_CLOCK(p) (TRACE_ENABLED(p) ? now_sec() : 0.0)
+#define TRACE_NS(p, t0) (TRACE_ENABLED(p) && (t0) > 0 ? (unsigned long long)((now_sec() - (t0)) * 1e9) : 0ULL)
+#define TRACE1(p, a) DTRACE_PROBE1(playlist, p, a)
+#define TRACE2(p, a, b) DTRACE_PROBE2(playlist, p, a, b)
+#define TRACE3(p, a, b, c) DTRACE_PROBE3(playlist, p, a, b, c)
+#define TRACE4(p, a, b, c, d) DTRACE_PROBE4(playlist, p, a, b, c, d)
+#else
+#define TRACE_ENABLED(p) 0
+#define TRACE_CLOCK(p) 0.0
+#define TRACE_NS(p, t0) (0ULL * sizeof(t0))
+#define TRACE1(p, a) ((void)sizeof(a))
+#define TRACE2(p, a, b) ((void)sizeof(a), (void)sizeof(b))
+#define TRACE3(p, a, b, c) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c))
+#define TRACE4(p, a, b, c, d) ((void)sizeof(a), (void)sizeof(b), (void)sizeof(c), (void)sizeof(d))
+#endif
 
 #define INITIAL_CAP 32
 #define MAX_LINE 1024
 #define DEFAULT_SAVE "playlist.csv"
+#define DEFAULT_JOURNAL "playlist.csv.journal"
+#define DEFAULT_HISTORY "playlist.csv.history"
+#define DEFAULT_TRACE "playlist.trace.json"
+#define TRACE_SPAN_MAX (1u << 20) /* spans kept per thread buffer */
+#define TRACE_CHUNK_ROWS 65536   /* CSV rows per "csv parse" span */
+#define RECENT_CAP 256           /* plays kept in the in-memory ring */
+#define TOP_CAP 100              /* most-played tracks kept in the heap */
+#define HISTORY_REC_LEN 16       /* u64 track key, i64 unix time */
+#define JOURNAL_GROUP 64         /* batched policy: records per fsync */
+#define JOURNAL_GROUP_SEC 0.050  /* batched policy: max wait before fsync */
+#define EXTSORT_DEFAULT_MB 64
+#define EXTSORT_FANIN 64         /* runs merged per pass */
+#define TRACK_OVERHEAD 64        /* est. allocator overhead per track (3 strings) */
+#define COMPACT_AUTO_PCT 50      /* auto-compact when this % of the footprint is waste */
+#define COMPACT_MIN_WASTE (1u << 20) /* ... and at least this many bytes */
+#define PAGED_PAGE_SIZE 8192     /* > largest record: 3 fields of MAX_LINE */
+#define PAGED_PAGE_HDR 4         /* u16 count, u16 bytes used by records */
+#define PAGED_DEFAULT_KB 1024
+#define MAX_SCAN_THREADS 64
+#define PAR_SCAN_MIN 65536 /* below this a single thread scans faster */
+#define PREFETCH_DIST 8    /* tracks ahead whose strings are prefetched */
+#define SORT_INSERTION 16  /* introsort: insertion sort at or below this size */
+#define COUNT_SORT_SLACK 65536 /* duration counting sort while max-min < n + this */
+#define MH_HASHES 32       /* MinHash signature length */
+#define LSH_BANDS 16       /* MH_HASHES = LSH_BANDS * LSH_ROWS */
+#define LSH_ROWS 2
+#define LSH_SCAN_MAX 2000  /* candidates examined per bucket */
+#define MAX_TOKENS 256     /* words per track used for similarity */
+#define PERFGATE_RUNS 9         /* timed runs per scenario */
+#define PERFGATE_TRACKS 200000
+#define PERFGATE_THRESHOLD 10.0 /* % slowdown of the median that fails */
+#define HIST_SUB_BITS 6          /* 64 sub-buckets per power of two: ~1.6% precision */
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_MAX_EXP 47          /* values up to 2^48 ns (~78 hours) */
+#define HIST_BUCKETS (HIST_SUB + (HIST_MAX_EXP + 1 - HIST_SUB_BITS) * HIST_SUB)
+#define HIST_MAX_CMDS 64
+#define DEFAULT_SHM "playlist"
+#define SHM_MAGIC 0x504C5348u /* "PLSH" */
+#define SHM_VERSION 1
+#define PLB_VERSION 1
+#define PLB_BASE_FIELDS 4     /* title, artist, album, duration */
+#define PLB_FIELDS 11         /* base plus the metadata columns */
+#define PLB_BLOCK_TRACKS 4096
+#define PLB_HEADER_LEN 32
+#define PLB_BLOCK_HDR_LEN 16
+#define PLB_INDEX_ENTRY_LEN 16
+#define PLB_TRAILER_LEN 24
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+#define PREFETCH(p) ((void)(p))
+#endif
 
 /* Track structure */
 typedef struct {
@@ -27,14 +186,66 @@ typedef struct {
     char *artist;
     char *album;
     int duration; /* seconds */
+    unsigned int id; /* stable within a playlist; 0 for scratch copies */
 } Track;
 
+/* Prefetching of upcoming tracks' strings in scan loops (bench toggles it) */
+static int g_prefetch = 1;
+static void prefetch_track(const Track *items, size_t i, size_t n) {
+    if (!g_prefetch || i + PREFETCH_DIST >= n) return;
+    const Track *t = &items[i + PREFETCH_DIST];
+    PREFETCH(t->title); PREFETCH(t->artist); PREFETCH(t->album);
+}
+
+/* Open-addressing map from non-zero 64-bit hashes to a long long value */
+typedef struct {
+    unsigned long long *keys;
+    long long *vals;
+    size_t cap, size;
+} HashMap64;
+
+/* Extended metadata is kept in typed columns indexed by track id, beside the
+   track array rather than in Track, so scans over tracks stay compact and a
+   filter on one field reads only that column. Columns are allocated on first
+   use and genre names are interned into a dictionary. 0 or NULL is unset. */
+typedef enum { META_GENRE, META_YEAR, META_TRACK, META_RATING, META_PLAYS, META_LAST_PLAYED, META_PATH, META_NFIELDS } MetaField;
+typedef struct {
+    size_t rows;               /* ids below rows have storage */
+    unsigned short *genre;     /* index into genres + 1 */
+    unsigned short *year;
+    unsigned char *track_no;
+    unsigned char *rating;     /* 1..5 */
+    unsigned int *plays;
+    long long *last_played;    /* unix time */
+    char **path;
+    char **genres;
+    size_t ngenres;
+    HashMap64 genre_ids;       /* normalized genre -> index + 1 */
+    unsigned long plays_epoch; /* bumped whenever a plays value changes */
+} MetaColumns;
+
 /* Playlist dynamic array */
+struct SmartSet;
 typedef struct {
     Track *items;
     size_t size;
     size_t cap;
+    unsigned int next_id;
+    struct SmartSet *smart; /* rules notified of adds/removes, may be NULL */
+    struct SimIndex *sim;   /* similarity index kept up to date, may be NULL */
+    MetaColumns meta;
+    char *blob;             /* strings packed by compact_playlist, NULL if none */
+    size_t blob_len, blob_tracks; /* its bytes, tracks whose strings live in it */
+    size_t str_bytes;       /* live string bytes, NULs included */
+    size_t hole_bytes;      /* freed string bytes not yet reused by adds */
+    size_t blob_dead;       /* blob bytes of tracks removed since */
 } Playlist;
+static void smart_track_added(struct SmartSet *ss, const Track *t);
+static void smart_track_removed(struct SmartSet *ss, const Track *t);
+static void sim_track_added(struct SimIndex *si, const Track *t);
+static void sim_track_removed(struct SimIndex *si, const Track *t);
+static void meta_clear_row(MetaColumns *m, unsigned int id);
+static void meta_free(MetaColumns *m);
 
 /* Utility functions */
 static void trim(char *s) {
@@ -51,25 +262,177 @@ static char *strdup_safe(const char *s) {
     if (!d) { perror("strdup"); exit(1); }
     return d;
 }
+static double now_sec(void);
+static double g_input_wait; /* seconds commands spent waiting on prompts */
 static char *read_input_line(const char *prompt) {
     char buf[MAX_LINE];
     if (prompt) printf("%s", prompt);
-    if (!fgets(buf, sizeof(buf), stdin)) return NULL;
+    double t0 = now_sec();
+    char *got = fgets(buf, sizeof(buf), stdin);
+    g_input_wait += now_sec() - t0;
+    if (!got) return NULL;
     size_t len = strlen(buf);
     if (len && buf[len-1] == '\n') buf[len-1] = '\0';
     trim(buf);
     return strdup_safe(buf);
 }
-static char *str_tolower_copy(const char *s) {
-    char *d = strdup_safe(s);
-    for (char *p = d; *p; ++p) *p = (char)tolower((unsigned char)*p);
-    return d;
+
+static double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Timeline tracing (trace on): scoped spans go into the recording thread's
+   own buffer with no locks, and are written out as Chrome trace JSON. A
+   thread claims a free buffer on its first span and hands it back when it
+   exits, so the short-lived scan workers reuse rows instead of adding one
+   per run. Buffers are only read and reset from the main thread between
+   commands, when no worker is running. */
+typedef struct { char name[24]; double t0, t1; long long arg; } TraceSpan;
+typedef struct TraceBuf {
+    struct TraceBuf *next;
+    atomic_int owned;
+    int tid, main;
+    TraceSpan *spans;
+    atomic_size_t len;
+    size_t cap, dropped;
+} TraceBuf;
+static atomic_int g_tracing;
+static _Atomic(TraceBuf *) g_trace_bufs;
+static atomic_int g_trace_ntids;
+static double g_trace_origin;
+static pthread_t g_main_thread;
+static pthread_key_t g_trace_key;
+static pthread_once_t g_trace_once = PTHREAD_ONCE_INIT;
+static _Thread_local TraceBuf *t_trace;
+
+static void trace_release(void *p) { atomic_store(&((TraceBuf *)p)->owned, 0); }
+static void trace_key_init(void) { pthread_key_create(&g_trace_key, trace_release); }
+static TraceBuf *trace_claim(void) {
+    pthread_once(&g_trace_once, trace_key_init);
+    TraceBuf *b;
+    for (b = atomic_load(&g_trace_bufs); b; b = b->next) {
+        int unowned = 0;
+        if (atomic_compare_exchange_strong(&b->owned, &unowned, 1)) break;
+    }
+    if (!b) {
+        b = calloc(1, sizeof(*b));
+        if (!b) { perror("calloc"); exit(1); }
+        atomic_init(&b->owned, 1);
+        b->tid = atomic_fetch_add(&g_trace_ntids, 1) + 1;
+        b->next = atomic_load(&g_trace_bufs);
+        while (!atomic_compare_exchange_weak(&g_trace_bufs, &b->next, b)) ;
+    }
+    b->main = pthread_equal(pthread_self(), g_main_thread);
+    pthread_setspecific(g_trace_key, b);
+    return b;
+}
+static void trace_span(const char *name, double t0, double t1, long long arg) {
+    TraceBuf *b = t_trace ? t_trace : (t_trace = trace_claim());
+    size_t n = atomic_load_explicit(&b->len, memory_order_relaxed);
+    if (n == b->cap) {
+        if (n >= TRACE_SPAN_MAX) { b->dropped++; return; }
+        size_t cap = n ? n * 2 : 256;
+        TraceSpan *sp = realloc(b->spans, cap * sizeof(TraceSpan));
+        if (!sp) { perror("realloc"); exit(1); }
+        b->spans = sp;
+        b->cap = cap;
+    }
+    TraceSpan *sp = &b->spans[n];
+    snprintf(sp->name, sizeof(sp->name), "%s", name);
+    sp->t0 = t0; sp->t1 = t1; sp->arg = arg;
+    atomic_store_explicit(&b->len, n + 1, memory_order_release);
+}
+/* trace_begin returns 0 when tracing is off, and trace_end then does nothing;
+   arg is a size shown with the span, or -1 for none */
+static double trace_begin(void) {
+    return atomic_load_explicit(&g_tracing, memory_order_relaxed) ? now_sec() : 0;
+}
+static void trace_end(const char *name, double t0, long long arg) {
+    if (t0) trace_span(name, t0, now_sec(), arg);
+}
+static size_t trace_count(void) {
+    size_t n = 0;
+    for (TraceBuf *b = atomic_load(&g_trace_bufs); b; b = b->next) n += atomic_load(&b->len);
+    return n;
+}
+static void trace_start(void) {
+    for (TraceBuf *b = atomic_load(&g_trace_bufs); b; b = b->next) { atomic_store(&b->len, 0); b->dropped = 0; }
+    g_trace_origin = now_sec();
+    atomic_store(&g_tracing, 1);
+}
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') fprintf(f, "\\%c", c);
+        else if (c < 0x20) fprintf(f, "\\u%04x", c);
+        else fputc(c, f);
+    }
+    fputc('"', f);
+}
+static FILE *atomic_begin(const char *path, char *tmp);
+static int atomic_finish(FILE *f, const char *tmp, const char *path, int ok);
+/* Chrome trace event format: one complete ("X") event per span, timestamps
+   in microseconds since trace on, plus a thread_name record per buffer */
+static int trace_dump(const char *path) {
+    char tmp[MAX_LINE + 32];
+    FILE *f = atomic_begin(path, tmp); /* a failed dump keeps the previous trace */
+    if (!f) return 0;
+    int pid = (int)getpid();
+    size_t dropped = 0;
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"playlist\"}}", pid);
+    for (TraceBuf *b = atomic_load(&g_trace_bufs); b; b = b->next) {
+        size_t n = atomic_load_explicit(&b->len, memory_order_acquire);
+        dropped += b->dropped;
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+                pid, b->tid, b->main ? "main" : "worker", b->tid);
+        for (size_t i = 0; i < n; ++i) {
+            const TraceSpan *sp = &b->spans[i];
+            fprintf(f, ",\n{\"name\":");
+            json_string(f, sp->name);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", pid, b->tid,
+                    (sp->t0 - g_trace_origin) * 1e6, (sp->t1 - sp->t0) * 1e6);
+            if (sp->arg >= 0) fprintf(f, ",\"args\":{\"n\":%lld}", sp->arg);
+            fputc('}', f);
+        }
+    }
+    fprintf(f, "\n]}\n");
+    if (dropped) fprintf(stderr, "trace: %zu span(s) dropped, buffers full\n", dropped);
+    return atomic_finish(f, tmp, path, !ferror(f));
+}
+
+/* NUMA helpers: no-ops unless built with libnuma */
+#ifdef HAVE_LIBNUMA
+static int numa_node_count(void) {
+    return numa_available() < 0 ? 1 : numa_num_configured_nodes();
+}
+static void bind_to_node(int node) {
+    if (numa_available() >= 0) numa_run_on_node(node);
+}
+#else
+static int numa_node_count(void) { return 1; }
+static void bind_to_node(int node) { (void)node; }
+#endif
+static size_t scan_thread_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n < 1) n = 1;
+    if (n > MAX_SCAN_THREADS) n = MAX_SCAN_THREADS;
+    return (size_t)n;
 }
 
 /* Playlist operations */
 static void init_playlist(Playlist *pl) {
     pl->cap = INITIAL_CAP;
     pl->size = 0;
+    pl->next_id = 1;
+    pl->smart = NULL;
+    pl->sim = NULL;
+    memset(&pl->meta, 0, sizeof(pl->meta));
+    pl->blob = NULL;
+    pl->blob_len = pl->blob_tracks = pl->str_bytes = pl->hole_bytes = pl->blob_dead = 0;
     pl->items = calloc(pl->cap, sizeof(Track));
     if (!pl->items) { perror("calloc"); exit(1); }
 }
@@ -79,12 +442,33 @@ static void free_track(Track *t) {
     t->title = t->artist = t->album = NULL;
     t->duration = 0;
 }
+/* Tracks of a compacted playlist point into pl->blob; only loose strings
+   are freed one by one */
+static int in_blob(const Playlist *pl, const char *s) {
+    return pl->blob && (uintptr_t)s - (uintptr_t)pl->blob < pl->blob_len;
+}
+static void release_track(Playlist *pl, Track *t) {
+    if (in_blob(pl, t->title)) { t->title = t->artist = t->album = NULL; t->duration = 0; }
+    else free_track(t);
+}
+static void release_blob(Playlist *pl) {
+    free(pl->blob);
+    pl->blob = NULL;
+    pl->blob_len = pl->blob_tracks = pl->blob_dead = 0;
+}
+static size_t track_str_bytes(const Track *t) {
+    return strlen(t->title) + strlen(t->artist) + strlen(t->album) + 3;
+}
+static size_t sub_floor0(size_t a, size_t b) { return a > b ? a - b : 0; }
 static void free_playlist(Playlist *pl) {
     if (!pl) return;
-    for (size_t i = 0; i < pl->size; ++i) free_track(&pl->items[i]);
+    for (size_t i = 0; i < pl->size; ++i) release_track(pl, &pl->items[i]);
     free(pl->items);
+    release_blob(pl);
+    meta_free(&pl->meta);
     pl->items = NULL;
     pl->size = pl->cap = 0;
+    pl->str_bytes = pl->hole_bytes = 0;
 }
 static void ensure_capacity(Playlist *pl) {
     if (pl->size < pl->cap) return;
@@ -92,19 +476,557 @@ static void ensure_capacity(Playlist *pl) {
     pl->items = realloc(pl->items, pl->cap * sizeof(Track));
     if (!pl->items) { perror("realloc"); exit(1); }
 }
-static void add_track(Playlist *pl, const char *title, const char *artist, const char *album, int duration) {
+/* Takes ownership of the malloc'd strings */
+static void add_track_owned(Playlist *pl, char *title, char *artist, char *album, int duration) {
     ensure_capacity(pl);
     Track *t = &pl->items[pl->size++];
-    t->title = strdup_safe(title);
-    t->artist = strdup_safe(artist);
-    t->album = strdup_safe(album);
+    t->title = title;
+    t->artist = artist;
+    t->album = album;
     t->duration = duration;
+    t->id = pl->next_id++;
+    size_t bytes = track_str_bytes(t);
+    pl->str_bytes += bytes;
+    pl->hole_bytes = sub_floor0(pl->hole_bytes, bytes + TRACK_OVERHEAD);
+    if (pl->smart) smart_track_added(pl->smart, t);
+    if (pl->sim) sim_track_added(pl->sim, t);
+}
+static void add_track(Playlist *pl, const char *title, const char *artist, const char *album, int duration) {
+    add_track_owned(pl, strdup_safe(title), strdup_safe(artist), strdup_safe(album), duration);
+}
+/* Frees a track that is leaving the playlist (the caller closes the gap) */
+static void drop_track(Playlist *pl, Track *t) {
+    if (pl->smart) smart_track_removed(pl->smart, t);
+    if (pl->sim) sim_track_removed(pl->sim, t);
+    meta_clear_row(&pl->meta, t->id);
+    size_t bytes = track_str_bytes(t);
+    pl->str_bytes = sub_floor0(pl->str_bytes, bytes);
+    if (in_blob(pl, t->title)) { pl->blob_tracks--; pl->blob_dead += bytes; }
+    else pl->hole_bytes += bytes + TRACK_OVERHEAD;
+    release_track(pl, t);
+}
+static void clear_playlist(Playlist *pl) {
+    while (pl->size) drop_track(pl, &pl->items[--pl->size]);
 }
 static void remove_track_at(Playlist *pl, size_t idx) {
     if (idx >= pl->size) return;
-    free_track(&pl->items[idx]);
+    TRACE2(remove__start, idx, pl->size);
+    double t0 = TRACE_CLOCK(remove__done);
+    drop_track(pl, &pl->items[idx]);
     for (size_t i = idx + 1; i < pl->size; ++i) pl->items[i-1] = pl->items[i];
     pl->size--;
+    TRACE3(remove__done, idx, pl->size, TRACE_NS(remove__done, t0));
+}
+
+/* Track identity: 64-bit hash of title/artist/album, case-folded and with
+   whitespace runs collapsed, so "The  Beatles" and "the beatles" match */
+static unsigned long long hash_mix(unsigned long long h) {
+    h ^= h >> 33; h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33; h *= 0xC4CEB9FE1A85EC53ull;
+    return h ^ (h >> 33);
+}
+static unsigned long long hash_normalized(unsigned long long h, const char *s) {
+    int space = 0;
+    while (*s && isspace((unsigned char)*s)) s++;
+    for (; *s; ++s) {
+        if (isspace((unsigned char)*s)) { space = 1; continue; }
+        if (space) { h = (h ^ ' ') * 0x100000001B3ull; space = 0; }
+        h = (h ^ (unsigned char)tolower((unsigned char)*s)) * 0x100000001B3ull;
+    }
+    return (h ^ 0x1F) * 0x100000001B3ull; /* field separator */
+}
+static unsigned long long track_key_hash(const Track *t) {
+    unsigned long long h = 0xCBF29CE484222325ull; /* FNV-1a */
+    h = hash_normalized(h, t->title);
+    h = hash_normalized(h, t->artist);
+    h = hash_normalized(h, t->album);
+    h = hash_mix(h);
+    return h ? h : 1; /* 0 marks an empty slot */
+}
+
+/* Open-addressing set of non-zero 64-bit hashes */
+typedef struct {
+    unsigned long long *slots;
+    size_t cap, size;
+} HashSet64;
+static int hs_contains(const HashSet64 *hs, unsigned long long h) {
+    if (!hs->cap) return 0;
+    for (size_t i = h & (hs->cap - 1);; i = (i + 1) & (hs->cap - 1)) {
+        if (hs->slots[i] == h) return 1;
+        if (!hs->slots[i]) return 0;
+    }
+}
+static int hs_insert(HashSet64 *hs, unsigned long long h) {
+    if ((hs->size + 1) * 4 > hs->cap * 3) {
+        HashSet64 bigger = {NULL, hs->cap ? hs->cap * 2 : 1024, 0};
+        bigger.slots = calloc(bigger.cap, sizeof(unsigned long long));
+        if (!bigger.slots) { perror("calloc"); exit(1); }
+        for (size_t i = 0; i < hs->cap; ++i) if (hs->slots[i]) hs_insert(&bigger, hs->slots[i]);
+        free(hs->slots);
+        *hs = bigger;
+    }
+    size_t i = h & (hs->cap - 1);
+    for (; hs->slots[i]; i = (i + 1) & (hs->cap - 1))
+        if (hs->slots[i] == h) return 0;
+    hs->slots[i] = h;
+    hs->size++;
+    return 1;
+}
+static void hs_free(HashSet64 *hs) {
+    free(hs->slots);
+    hs->slots = NULL;
+    hs->cap = hs->size = 0;
+}
+
+/* Value slot for key; with create, a missing key is inserted with value 0 */
+static long long *hm_slot(HashMap64 *hm, unsigned long long key, int create) {
+    if (create && (hm->size + 1) * 4 > hm->cap * 3) {
+        HashMap64 bigger = {NULL, NULL, hm->cap ? hm->cap * 2 : 1024, 0};
+        bigger.keys = calloc(bigger.cap, sizeof(unsigned long long));
+        bigger.vals = malloc(bigger.cap * sizeof(long long));
+        if (!bigger.keys || !bigger.vals) { perror("malloc"); exit(1); }
+        for (size_t i = 0; i < hm->cap; ++i)
+            if (hm->keys[i]) *hm_slot(&bigger, hm->keys[i], 1) = hm->vals[i];
+        free(hm->keys); free(hm->vals);
+        *hm = bigger;
+    }
+    if (!hm->cap) return NULL;
+    size_t i = key & (hm->cap - 1);
+    for (; hm->keys[i]; i = (i + 1) & (hm->cap - 1))
+        if (hm->keys[i] == key) return &hm->vals[i];
+    if (!create) return NULL;
+    hm->keys[i] = key;
+    hm->vals[i] = 0;
+    hm->size++;
+    return &hm->vals[i];
+}
+static long long hm_get(const HashMap64 *hm, unsigned long long key) {
+    long long *v = hm_slot((HashMap64 *)hm, key, 0);
+    return v ? *v : 0;
+}
+static void hm_remove(HashMap64 *hm, unsigned long long key) {
+    if (!hm->cap) return;
+    size_t mask = hm->cap - 1, i = key & mask;
+    while (hm->keys[i] && hm->keys[i] != key) i = (i + 1) & mask;
+    if (!hm->keys[i]) return;
+    /* backward-shift deletion keeps probe chains intact without tombstones */
+    for (size_t j = (i + 1) & mask; hm->keys[j]; j = (j + 1) & mask) {
+        size_t home = hm->keys[j] & mask;
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            hm->keys[i] = hm->keys[j];
+            hm->vals[i] = hm->vals[j];
+            i = j;
+        }
+    }
+    hm->keys[i] = 0;
+    hm->size--;
+}
+static void hm_free(HashMap64 *hm) {
+    free(hm->keys); free(hm->vals);
+    memset(hm, 0, sizeof(*hm));
+}
+
+/* Set of track ids with O(1) add/remove/contains and a dense array for
+   iteration and random picks */
+typedef struct {
+    unsigned int *ids;
+    size_t n, cap;
+    HashMap64 pos; /* id -> index in ids + 1 */
+} IdSet;
+static int idset_has(const IdSet *s, unsigned int id) { return hm_get(&s->pos, id) != 0; }
+static void idset_add(IdSet *s, unsigned int id) {
+    long long *p = hm_slot(&s->pos, id, 1);
+    if (*p) return;
+    if (s->n == s->cap) {
+        s->cap = s->cap ? s->cap * 2 : 64;
+        s->ids = realloc(s->ids, s->cap * sizeof(unsigned int));
+        if (!s->ids) { perror("realloc"); exit(1); }
+    }
+    s->ids[s->n++] = id;
+    *p = (long long)s->n;
+}
+static void idset_remove(IdSet *s, unsigned int id) {
+    long long p = hm_get(&s->pos, id);
+    if (!p) return;
+    unsigned int last = s->ids[--s->n];
+    s->ids[p - 1] = last;
+    *hm_slot(&s->pos, last, 1) = p;
+    hm_remove(&s->pos, id);
+}
+static void idset_free(IdSet *s) {
+    free(s->ids);
+    hm_free(&s->pos);
+    memset(s, 0, sizeof(*s));
+}
+
+/* Smart playlists: a rule is a conjunction of predicates over track fields,
+   e.g. "artist=Queen dur<240". Membership is kept as an IdSet and updated
+   only for the track being added or removed. Rules with an equality
+   predicate on title/artist/album are indexed by that field value, so an
+   added track is evaluated only against the rules in its three buckets plus
+   the unindexed ones. */
+typedef enum { FIELD_TITLE, FIELD_ARTIST, FIELD_ALBUM, FIELD_DURATION } TrackField;
+typedef enum { OP_EQ, OP_NE, OP_CONTAINS, OP_LT, OP_LE, OP_GT, OP_GE } RuleOp;
+typedef struct {
+    TrackField field;
+    RuleOp op;
+    char *text;
+    int num;
+} Predicate;
+typedef struct {
+    char *name;
+    char *source;        /* rule text as entered */
+    Predicate *preds;
+    size_t npreds;
+    IdSet members;
+    unsigned long long index_key; /* bucket key, 0 if unindexed */
+    long next;           /* next rule in the same bucket, -1 at end */
+} SmartPlaylist;
+typedef struct SmartSet {
+    SmartPlaylist *rules;
+    size_t n, cap;
+    HashMap64 buckets;   /* index key -> first rule + 1 */
+} SmartSet;
+
+static const char *track_field_text(const Track *t, TrackField f) {
+    return f == FIELD_TITLE ? t->title : f == FIELD_ARTIST ? t->artist : t->album;
+}
+static unsigned long long field_index_key(TrackField f, const char *value) {
+    unsigned long long h = hash_mix(hash_normalized(0xCBF29CE484222325ull + f, value));
+    return h ? h : 1;
+}
+static int predicate_holds(const Predicate *p, const Track *t) {
+    if (p->field == FIELD_DURATION) {
+        int d = t->duration;
+        switch (p->op) {
+        case OP_EQ: return d == p->num;
+        case OP_NE: return d != p->num;
+        case OP_LT: return d < p->num;
+        case OP_LE: return d <= p->num;
+        case OP_GT: return d > p->num;
+        case OP_GE: return d >= p->num;
+        default: return 0;
+        }
+    }
+    const char *v = track_field_text(t, p->field);
+    switch (p->op) {
+    case OP_EQ: return strcasecmp(v, p->text) == 0;
+    case OP_NE: return strcasecmp(v, p->text) != 0;
+    case OP_CONTAINS: return strcasestr(v, p->text) != NULL;
+    default: return 0;
+    }
+}
+static int rule_holds(const SmartPlaylist *sp, const Track *t) {
+    for (size_t i = 0; i < sp->npreds; ++i)
+        if (!predicate_holds(&sp->preds[i], t)) return 0;
+    return 1;
+}
+/* Comparison operator at *s, advancing past it; returns 0 if there is none */
+static int parse_rule_op(const char **s, RuleOp *op) {
+    const char *p = *s;
+    if (p[0] == '!' && p[1] == '=') { *op = OP_NE; p += 2; }
+    else if (p[0] == '<' && p[1] == '=') { *op = OP_LE; p += 2; }
+    else if (p[0] == '>' && p[1] == '=') { *op = OP_GE; p += 2; }
+    else if (p[0] == '=') { *op = OP_EQ; p++; }
+    else if (p[0] == '~') { *op = OP_CONTAINS; p++; }
+    else if (p[0] == '<') { *op = OP_LT; p++; }
+    else if (p[0] == '>') { *op = OP_GT; p++; }
+    else return 0;
+    *s = p;
+    return 1;
+}
+/* Value at *s, quoted or up to the next space; NULL if a quote is unclosed */
+static char *parse_rule_value(const char **s) {
+    const char *v = *s, *end;
+    if (*v == '"') { end = strchr(++v, '"'); if (!end) return NULL; *s = end + 1; }
+    else { end = v + strcspn(v, " "); *s = end; }
+    char *out = strndup(v, (size_t)(end - v));
+    if (!out) { perror("strndup"); exit(1); }
+    return out;
+}
+/* Parses "field<op>value" terms separated by spaces; values may be quoted */
+static int parse_rule(const char *text, Predicate **out, size_t *n) {
+    Predicate *preds = NULL;
+    size_t np = 0;
+    const char *s = text;
+    for (;;) {
+        while (*s == ' ') s++;
+        if (!*s) break;
+        TrackField f;
+        size_t flen;
+        if (strncasecmp(s, "title", 5) == 0) { f = FIELD_TITLE; flen = 5; }
+        else if (strncasecmp(s, "artist", 6) == 0) { f = FIELD_ARTIST; flen = 6; }
+        else if (strncasecmp(s, "album", 5) == 0) { f = FIELD_ALBUM; flen = 5; }
+        else if (strncasecmp(s, "duration", 8) == 0) { f = FIELD_DURATION; flen = 8; }
+        else if (strncasecmp(s, "dur", 3) == 0) { f = FIELD_DURATION; flen = 3; }
+        else goto bad;
+        s += flen;
+        RuleOp op;
+        if (!parse_rule_op(&s, &op)) goto bad;
+        if (f == FIELD_DURATION && op == OP_CONTAINS) goto bad;
+        if (f != FIELD_DURATION && op != OP_EQ && op != OP_NE && op != OP_CONTAINS) goto bad;
+        char *value = parse_rule_value(&s);
+        if (!value) goto bad;
+        Predicate *np_arr = realloc(preds, (np + 1) * sizeof(Predicate));
+        if (!np_arr) { perror("realloc"); exit(1); }
+        preds = np_arr;
+        Predicate *p = &preds[np++];
+        p->field = f;
+        p->op = op;
+        p->text = value;
+        p->num = atoi(p->text);
+    }
+    if (!np) goto bad;
+    *out = preds;
+    *n = np;
+    return 1;
+bad:
+    for (size_t i = 0; i < np; ++i) free(preds[i].text);
+    free(preds);
+    return 0;
+}
+static SmartPlaylist *smart_find(SmartSet *ss, const char *name) {
+    for (size_t i = 0; i < ss->n; ++i)
+        if (strcasecmp(ss->rules[i].name, name) == 0) return &ss->rules[i];
+    return NULL;
+}
+static void smart_rebuild_buckets(SmartSet *ss) {
+    hm_free(&ss->buckets);
+    for (size_t i = ss->n; i-- > 0;) {
+        SmartPlaylist *sp = &ss->rules[i];
+        sp->next = -1;
+        if (!sp->index_key) continue;
+        long long *head = hm_slot(&ss->buckets, sp->index_key, 1);
+        sp->next = *head - 1;
+        *head = (long long)i + 1;
+    }
+}
+/* Adds a rule and evaluates it once over the current playlist */
+static SmartPlaylist *smart_define(SmartSet *ss, const Playlist *pl, const char *name, const char *text) {
+    Predicate *preds;
+    size_t np;
+    if (smart_find(ss, name) || !parse_rule(text, &preds, &np)) return NULL;
+    if (ss->n == ss->cap) {
+        ss->cap = ss->cap ? ss->cap * 2 : 8;
+        ss->rules = realloc(ss->rules, ss->cap * sizeof(SmartPlaylist));
+        if (!ss->rules) { perror("realloc"); exit(1); }
+    }
+    SmartPlaylist *sp = &ss->rules[ss->n++];
+    memset(sp, 0, sizeof(*sp));
+    sp->name = strdup_safe(name);
+    sp->source = strdup_safe(text);
+    sp->preds = preds;
+    sp->npreds = np;
+    for (size_t i = 0; i < np && !sp->index_key; ++i)
+        if (preds[i].field != FIELD_DURATION && preds[i].op == OP_EQ)
+            sp->index_key = field_index_key(preds[i].field, preds[i].text);
+    smart_rebuild_buckets(ss);
+    for (size_t i = 0; i < pl->size; ++i)
+        if (rule_holds(sp, &pl->items[i])) idset_add(&sp->members, pl->items[i].id);
+    return sp;
+}
+static void smart_free_rule(SmartPlaylist *sp) {
+    for (size_t i = 0; i < sp->npreds; ++i) free(sp->preds[i].text);
+    free(sp->preds); free(sp->name); free(sp->source);
+    idset_free(&sp->members);
+}
+static int smart_delete(SmartSet *ss, const char *name) {
+    SmartPlaylist *sp = smart_find(ss, name);
+    if (!sp) return 0;
+    smart_free_rule(sp);
+    *sp = ss->rules[--ss->n];
+    smart_rebuild_buckets(ss);
+    return 1;
+}
+static void smart_free(SmartSet *ss) {
+    for (size_t i = 0; i < ss->n; ++i) smart_free_rule(&ss->rules[i]);
+    free(ss->rules);
+    hm_free(&ss->buckets);
+    memset(ss, 0, sizeof(*ss));
+}
+static void smart_track_added(SmartSet *ss, const Track *t) {
+    for (size_t i = 0; i < ss->n; ++i)
+        if (!ss->rules[i].index_key && rule_holds(&ss->rules[i], t)) idset_add(&ss->rules[i].members, t->id);
+    for (int f = FIELD_TITLE; f <= FIELD_ALBUM; ++f) {
+        for (long r = hm_get(&ss->buckets, field_index_key((TrackField)f, track_field_text(t, (TrackField)f))) - 1;
+             r >= 0; r = ss->rules[r].next)
+            if (rule_holds(&ss->rules[r], t)) idset_add(&ss->rules[r].members, t->id);
+    }
+}
+static void smart_track_removed(SmartSet *ss, const Track *t) {
+    for (size_t i = 0; i < ss->n; ++i) idset_remove(&ss->rules[i].members, t->id);
+}
+
+/* Metadata columns */
+static const char *const meta_field_names[META_NFIELDS] = {"genre", "year", "track", "rating", "plays", "last_played", "path"};
+static const long long meta_field_max[META_NFIELDS] = {0, 9999, 255, 5, UINT_MAX, LLONG_MAX, 0};
+
+static int meta_field_lookup(const char *s, size_t len) {
+    for (int f = 0; f < META_NFIELDS; ++f)
+        if (strlen(meta_field_names[f]) == len && strncasecmp(s, meta_field_names[f], len) == 0) return f;
+    return -1;
+}
+static void *grow_zeroed(void *col, size_t old, size_t n, size_t elem) {
+    unsigned char *p = realloc(col, n * elem);
+    if (!p) { perror("realloc"); exit(1); }
+    memset(p + old * elem, 0, (n - old) * elem);
+    return p;
+}
+static void meta_reserve(MetaColumns *m, unsigned int id) {
+    if (id < m->rows) return;
+    size_t n = m->rows ? m->rows : 1024;
+    while (n <= id) n *= 2;
+    m->genre = grow_zeroed(m->genre, m->rows, n, sizeof(*m->genre));
+    m->year = grow_zeroed(m->year, m->rows, n, sizeof(*m->year));
+    m->track_no = grow_zeroed(m->track_no, m->rows, n, sizeof(*m->track_no));
+    m->rating = grow_zeroed(m->rating, m->rows, n, sizeof(*m->rating));
+    m->plays = grow_zeroed(m->plays, m->rows, n, sizeof(*m->plays));
+    m->last_played = grow_zeroed(m->last_played, m->rows, n, sizeof(*m->last_played));
+    m->path = grow_zeroed(m->path, m->rows, n, sizeof(*m->path));
+    m->rows = n;
+}
+static long long meta_num(const MetaColumns *m, unsigned int id, MetaField f) {
+    if (id >= m->rows) return 0;
+    switch (f) {
+    case META_GENRE: return m->genre[id];
+    case META_YEAR: return m->year[id];
+    case META_TRACK: return m->track_no[id];
+    case META_RATING: return m->rating[id];
+    case META_PLAYS: return m->plays[id];
+    case META_LAST_PLAYED: return m->last_played[id];
+    default: return 0;
+    }
+}
+/* Sets a numeric field (0 clears it); returns 0 if v is out of range */
+static int meta_set_num(MetaColumns *m, unsigned int id, MetaField f, long long v) {
+    if (f == META_GENRE || f == META_PATH || v < 0 || v > meta_field_max[f]) return 0;
+    if (!v && id >= m->rows) return 1;
+    meta_reserve(m, id);
+    switch (f) {
+    case META_YEAR: m->year[id] = (unsigned short)v; break;
+    case META_TRACK: m->track_no[id] = (unsigned char)v; break;
+    case META_RATING: m->rating[id] = (unsigned char)v; break;
+    case META_PLAYS: if (m->plays[id] != v) m->plays_epoch++; m->plays[id] = (unsigned int)v; break;
+    default: m->last_played[id] = v; break;
+    }
+    return 1;
+}
+/* Dictionary index + 1 of a genre name (case and spacing folded), 0 if full */
+static unsigned short meta_intern_genre(MetaColumns *m, const char *name) {
+    unsigned long long key = hash_mix(hash_normalized(0xCBF29CE484222325ull, name));
+    long long *slot = hm_slot(&m->genre_ids, key ? key : 1, 1);
+    if (*slot) return (unsigned short)*slot;
+    if (m->ngenres >= USHRT_MAX) { hm_remove(&m->genre_ids, key ? key : 1); return 0; }
+    char **g = realloc(m->genres, (m->ngenres + 1) * sizeof(char *));
+    if (!g) { perror("realloc"); exit(1); }
+    m->genres = g;
+    m->genres[m->ngenres++] = strdup_safe(name);
+    *slot = (long long)m->ngenres;
+    return (unsigned short)m->ngenres;
+}
+/* Sets field f from text as typed or read from a file; "" clears it.
+   Returns 0 if the value does not fit the column. */
+static int meta_set(MetaColumns *m, unsigned int id, MetaField f, const char *v) {
+    if (f != META_GENRE && f != META_PATH) {
+        char *end;
+        long long n = *v ? strtoll(v, &end, 10) : 0;
+        return (!*v || *end == '\0') && meta_set_num(m, id, f, n);
+    }
+    if (!*v && id >= m->rows) return 1;
+    meta_reserve(m, id);
+    if (f == META_PATH) {
+        free(m->path[id]);
+        m->path[id] = *v ? strdup_safe(v) : NULL;
+        return 1;
+    }
+    unsigned short g = *v ? meta_intern_genre(m, v) : 0;
+    if (*v && !g) return 0;
+    m->genre[id] = g;
+    return 1;
+}
+/* Field f as text, "" when unset; numbers are formatted into buf */
+static const char *meta_text(const MetaColumns *m, unsigned int id, MetaField f, char *buf, size_t n) {
+    if (id >= m->rows) return "";
+    if (f == META_PATH) return m->path[id] ? m->path[id] : "";
+    if (f == META_GENRE) return m->genre[id] ? m->genres[m->genre[id] - 1] : "";
+    long long v = meta_num(m, id, f);
+    if (!v) return "";
+    snprintf(buf, n, "%lld", v);
+    return buf;
+}
+static void meta_copy_row(MetaColumns *dst, unsigned int dst_id, const MetaColumns *src, unsigned int src_id) {
+    char buf[32];
+    for (int f = 0; f < META_NFIELDS; ++f) meta_set(dst, dst_id, (MetaField)f, meta_text(src, src_id, (MetaField)f, buf, sizeof(buf)));
+}
+static void meta_clear_row(MetaColumns *m, unsigned int id) {
+    if (id >= m->rows) return;
+    free(m->path[id]);
+    m->path[id] = NULL;
+    m->genre[id] = m->year[id] = 0;
+    m->track_no[id] = m->rating[id] = 0;
+    if (m->plays[id]) m->plays_epoch++;
+    m->plays[id] = 0;
+    m->last_played[id] = 0;
+}
+static void meta_free(MetaColumns *m) {
+    for (size_t i = 0; i < m->rows; ++i) free(m->path[i]);
+    for (size_t i = 0; i < m->ngenres; ++i) free(m->genres[i]);
+    free(m->genre); free(m->year); free(m->track_no); free(m->rating);
+    free(m->plays); free(m->last_played); free(m->path); free(m->genres);
+    hm_free(&m->genre_ids);
+    memset(m, 0, sizeof(*m));
+}
+static int num_holds(RuleOp op, long long v, long long want) {
+    switch (op) {
+    case OP_EQ: return v == want;
+    case OP_NE: return v != want;
+    case OP_LT: return v < want;
+    case OP_LE: return v <= want;
+    case OP_GT: return v > want;
+    case OP_GE: return v >= want;
+    default: return 0;
+    }
+}
+/* ANDs one term into mask[0..n), reading only field f's column. Unset values
+   match nothing, except for plays where 0 is a real count. */
+static int meta_scan_term(const MetaColumns *m, MetaField f, RuleOp op, const char *v, unsigned char *mask, size_t n) {
+    size_t rows = m->rows < n ? m->rows : n;
+    long long want = 0;
+    if (f == META_GENRE || f == META_PATH) {
+        if (op != OP_EQ && op != OP_NE && op != OP_CONTAINS) return 0;
+    } else {
+        char *end;
+        want = strtoll(v, &end, 10);
+        if (!*v || *end || op == OP_CONTAINS) return 0;
+    }
+    if (f == META_PATH) {
+        for (size_t id = 0; id < rows; ++id) {
+            const char *p = m->path[id];
+            mask[id] &= p && (op == OP_CONTAINS ? strcasestr(p, v) != NULL : (strcmp(p, v) == 0) == (op == OP_EQ));
+        }
+    } else if (f == META_GENRE) {
+        /* decide each dictionary entry once, then scan the id column */
+        unsigned char *ok = calloc(m->ngenres + 1, 1);
+        if (!ok) { perror("calloc"); exit(1); }
+        for (size_t g = 0; g < m->ngenres; ++g)
+            ok[g + 1] = op == OP_CONTAINS ? strcasestr(m->genres[g], v) != NULL : (strcasecmp(m->genres[g], v) == 0) == (op == OP_EQ);
+        for (size_t id = 0; id < rows; ++id) mask[id] &= ok[m->genre[id]];
+        free(ok);
+    } else {
+#define META_SCAN(col, set) for (size_t id = 0; id < rows; ++id) mask[id] &= (set) && num_holds(op, (long long)m->col[id], want)
+        switch (f) {
+        case META_YEAR: META_SCAN(year, m->year[id]); break;
+        case META_TRACK: META_SCAN(track_no, m->track_no[id]); break;
+        case META_RATING: META_SCAN(rating, m->rating[id]); break;
+        case META_PLAYS: META_SCAN(plays, 1); break;
+        default: META_SCAN(last_played, m->last_played[id]); break;
+        }
+#undef META_SCAN
+    }
+    /* ids without storage have every field unset */
+    unsigned char unset = f == META_PLAYS && num_holds(op, 0, want);
+    for (size_t id = rows; id < n; ++id) mask[id] &= unset;
+    return 1;
 }
 
 /* CSV helpers: fields do not contain newlines; commas allowed if quoted */
@@ -128,14 +1050,16 @@ static char *csv_read_field(char **sp) {
     if (*s == '"') {
         s++; /* skip leading quote */
         while (*s) {
-            if (*s == '"' && *(s+1) == '"') { tmp[ti++] = '"'; s += 2; continue; }
-            if (*s == '"') { s++; break; }
-            tmp[ti++] = *s++; if (ti+1 >= sizeof(tmp)) break;
+            char c;
+            if (*s == '"' && *(s+1) == '"') { c = '"'; s += 2; }
+            else if (*s == '"') { s++; break; }
+            else c = *s++;
+            if (ti+1 < sizeof(tmp)) tmp[ti++] = c; /* overlong fields are truncated */
         }
         while (*s && *s != ',') s++;
         if (*s == ',') s++;
     } else {
-        while (*s && *s != ',') { tmp[ti++] = *s++; if (ti+1 >= sizeof(tmp)) break; }
+        for (; *s && *s != ','; ++s) if (ti+1 < sizeof(tmp)) tmp[ti++] = *s;
         if (*s == ',') s++;
     }
     tmp[ti] = '\0';
@@ -143,154 +1067,3558 @@ static char *csv_read_field(char **sp) {
     return strdup_safe(tmp);
 }
 
-/* Save / Load playlist to CSV */
-static int save_playlist_csv(const Playlist *pl, const char *path) {
-    FILE *f = fopen(path, "w");
-    if (!f) return 0;
-    /* header */
-    fprintf(f, "title,artist,album,duration_seconds\n");
-    for (size_t i = 0; i < pl->size; ++i) {
-        csv_escape_field(f, pl->items[i].title); fputc(',', f);
-        csv_escape_field(f, pl->items[i].artist); fputc(',', f);
-        csv_escape_field(f, pl->items[i].album); fputc(',', f);
-        fprintf(f, "%d\n", pl->items[i].duration);
+static void write_csv_fields(FILE *f, const Track *t) {
+    csv_escape_field(f, t->title); fputc(',', f);
+    csv_escape_field(f, t->artist); fputc(',', f);
+    csv_escape_field(f, t->album); fputc(',', f);
+    fprintf(f, "%d", t->duration);
+}
+static void write_csv_row(FILE *f, const Track *t) {
+    write_csv_fields(f, t);
+    fputc('\n', f);
+}
+/* Metadata columns follow the base fields when a playlist has any */
+#define CSV_HEADER "title,artist,album,duration_seconds"
+#define CSV_META_HEADER ",genre,year,track,rating,plays,last_played,path"
+static void write_csv_meta(FILE *f, const MetaColumns *m, unsigned int id) {
+    char buf[32];
+    for (int k = 0; k < META_NFIELDS; ++k) {
+        fputc(',', f);
+        csv_escape_field(f, meta_text(m, id, (MetaField)k, buf, sizeof(buf)));
     }
-    fclose(f);
+}
+static void read_csv_meta(MetaColumns *m, unsigned int id, char *rest) {
+    for (int k = 0; rest && k < META_NFIELDS; ++k) {
+        char *v = csv_read_field(&rest);
+        meta_set(m, id, (MetaField)k, v);
+        free(v);
+    }
+}
+/* Parses one data row (newline already stripped) into t, which then owns
+   its strings; *rest is left at any fields after the base four (or NULL).
+   Rows without a title are rejected (returns 0). */
+static int parse_csv_row(char *line, Track *t, char **rest) {
+    char *p = line;
+    char *f1 = csv_read_field(&p);
+    char *f2 = csv_read_field(&p);
+    char *f3 = csv_read_field(&p);
+    char *f4 = csv_read_field(&p);
+    int dur = atoi(f4);
+    free(f4);
+    if (!*f1) { free(f1); free(f2); free(f3); return 0; }
+    t->title = f1; t->artist = f2; t->album = f3; t->duration = dur; t->id = 0;
+    *rest = p;
     return 1;
 }
-static int load_playlist_csv(Playlist *pl, const char *path) {
+static int parse_csv_track(char *line, Track *t) {
+    char *rest;
+    return parse_csv_row(line, t, &rest);
+}
+static int parse_csv_line(Playlist *pl, char *line) {
+    Track t;
+    char *rest;
+    if (!parse_csv_row(line, &t, &rest)) return 0;
+    add_track_owned(pl, t.title, t.artist, t.album, t.duration);
+    if (rest) read_csv_meta(&pl->meta, pl->items[pl->size - 1].id, rest);
+    return 1;
+}
+/* Reads one line of any length into *buf (grown as needed) without its
+   newline; returns 0 at end of file. Rows are never split, so a row the
+   writer produced always reads back as one row. */
+static int read_line(FILE *f, char **buf, size_t *cap) {
+    ssize_t n = getline(buf, cap, f);
+    if (n < 0) return 0;
+    if (n && (*buf)[n - 1] == '\n') (*buf)[n - 1] = '\0';
+    return 1;
+}
+/* Streaming row reader: opens path positioned after the header, if any */
+static FILE *open_csv_rows(const char *path) {
     FILE *f = fopen(path, "r");
-    if (!f) return 0;
-    char line[MAX_LINE];
-    /* skip header if present */
-    if (!fgets(line, sizeof(line), f)) { fclose(f); return 0; }
+    if (!f) return NULL;
+    char *line = NULL;
+    size_t cap = 0;
+    if (!read_line(f, &line, &cap)) { free(line); fclose(f); return NULL; }
     if (strstr(line, "title") == NULL || strstr(line, "artist") == NULL) {
         /* first line is data; rewind */
         fseek(f, 0, SEEK_SET);
     }
-    while (fgets(line, sizeof(line), f)) {
-        /* strip newline */
-        char *nl = strchr(line, '\n'); if (nl) *nl = '\0';
-        char *p = line;
-        char *f1 = csv_read_field(&p);
-        char *f2 = csv_read_field(&p);
-        char *f3 = csv_read_field(&p);
-        char *f4 = csv_read_field(&p);
-        int dur = atoi(f4);
-        if (*f1) add_track(pl, f1, f2, f3, dur);
-        free(f1); free(f2); free(f3); free(f4);
+    free(line);
+    return f;
+}
+/* The streaming paths (extsort, set operations, paged) carry only the base
+   fields, so they refuse a file whose header names metadata columns rather
+   than drop them */
+static int csv_has_meta(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char *line = NULL;
+    size_t cap = 0;
+    int has = read_line(f, &line, &cap) && strstr(line, CSV_META_HEADER) != NULL;
+    free(line);
+    fclose(f);
+    if (has) fprintf(stderr, "%s: has metadata columns this command would drop; use load and save instead\n", path);
+    return has;
+}
+/* Next track of a stream from open_csv_rows; *line and *cap are the caller's
+   read_line buffer, freed (and reset) when the stream ends */
+static int next_csv_track(FILE *f, char **line, size_t *cap, Track *t) {
+    while (read_line(f, line, cap))
+        if (parse_csv_track(*line, t)) return 1;
+    free(*line);
+    *line = NULL;
+    *cap = 0;
+    return 0;
+}
+
+/* Save / Load playlist to CSV */
+static int write_playlist_csv(const Playlist *pl, FILE *f) {
+    if (!pl->meta.rows) {
+        fprintf(f, CSV_HEADER "\n");
+        for (size_t i = 0; i < pl->size; ++i) write_csv_row(f, &pl->items[i]);
+        return !ferror(f);
+    }
+    fprintf(f, CSV_HEADER CSV_META_HEADER "\n");
+    for (size_t i = 0; i < pl->size; ++i) {
+        write_csv_fields(f, &pl->items[i]);
+        write_csv_meta(f, &pl->meta, pl->items[i].id);
+        fputc('\n', f);
+    }
+    return !ferror(f);
+}
+static int load_playlist_csv(Playlist *pl, const char *path) {
+    FILE *f = open_csv_rows(path);
+    if (!f) return 0;
+    char *line = NULL;
+    size_t cap = 0, rows = 0;
+    double span = trace_begin();
+    while (read_line(f, &line, &cap)) {
+        parse_csv_line(pl, line);
+        if (span && ++rows == TRACE_CHUNK_ROWS) { trace_end("csv parse", span, (long long)rows); span = trace_begin(); rows = 0; }
     }
+    if (rows) trace_end("csv parse", span, (long long)rows);
+    free(line);
     fclose(f);
     return 1;
 }
 
-/* Print helpers */
-static void print_track(const Track *t, size_t idx) {
-    int mins = t->duration / 60;
-    int secs = t->duration % 60;
-    printf("%3zu) %s\n     Artist: %s  Album: %s  Duration: %d:%02d\n",
-           idx+1, t->title, t->artist, t->album, mins, secs);
+/* Binary format (*.plb), all integers little-endian:
+     header   "PLBF" u16 version, u16 header_len, u32 fields, u32 block_tracks,
+              12 reserved bytes, u32 crc32c(header[0..28))
+     blocks   "PLBK" u32 ntracks, u32 payload_len, u32 crc32c(payload), payload
+     index    per block: u64 offset, u32 ntracks, u32 payload crc
+     trailer  u64 index_off, u32 nblocks, u32 crc32c(index), "PLBE",
+              u32 crc32c(trailer[0..20))
+   A record is u32 len followed by `fields` fields: title, artist, album as
+   strings (u32 len + bytes) and duration as i32, then, when the playlist has
+   metadata, genre (string), year, track, rating, plays (u32), last_played
+   (u64) and path (string). Readers take the fields they know and skip the
+   rest of the record, so later versions can append fields without breaking
+   older readers. A corrupt block is skipped; if the trailer is damaged the
+   blocks are found by scanning forward from the header. */
+static unsigned int crc32c_table[256];
+static void crc32c_init_table(void) {
+    for (unsigned int i = 0; i < 256; ++i) {
+        unsigned int c = i;
+        for (int k = 0; k < 8; ++k) c = (c & 1) ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        crc32c_table[i] = c;
+    }
 }
-static void list_playlist(const Playlist *pl) {
-    if (pl->size == 0) { printf("Playlist is empty.\n"); return; }
-    for (size_t i = 0; i < pl->size; ++i) print_track(&pl->items[i], i);
+static unsigned int crc32c_sw(unsigned int crc, const unsigned char *p, size_t n) {
+    if (!crc32c_table[1]) crc32c_init_table();
+    while (n--) crc = crc32c_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return crc;
 }
-
-/* Search (case-insensitive substring) */
-static void search_playlist(const Playlist *pl, const char *term) {
-    char *low = str_tolower_copy(term);
-    int found = 0;
-    for (size_t i = 0; i < pl->size; ++i) {
-        char *t = str_tolower_copy(pl->items[i].title);
-        char *a = str_tolower_copy(pl->items[i].artist);
-        char *al = str_tolower_copy(pl->items[i].album);
-        if (strstr(t, low) || strstr(a, low) || strstr(al, low)) {
-            print_track(&pl->items[i], i); found = 1;
-        }
-        free(t); free(a); free(al);
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <nmmintrin.h>
+__attribute__((target("sse4.2")))
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p, size_t n) {
+    unsigned long long c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        unsigned long long w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
     }
-    free(low);
-    if (!found) printf("No matches for \"%s\".\n", term);
+    crc = (unsigned int)c;
+    while (n--) crc = _mm_crc32_u8(crc, *p++);
+    return crc;
 }
-
-/* Shuffle: Fisher-Yates */
-static void shuffle_playlist(Playlist *pl) {
-    if (pl->size < 2) return;
-    srand((unsigned int)time(NULL));
-    for (size_t i = pl->size - 1; i > 0; --i) {
-        size_t j = rand() % (i + 1);
-        Track tmp = pl->items[i];
-        pl->items[i] = pl->items[j];
-        pl->items[j] = tmp;
+static int crc32c_hw_available(void) { return __builtin_cpu_supports("sse4.2"); }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p, size_t n) {
+    for (; n >= 8; n -= 8, p += 8) {
+        unsigned long long w;
+        memcpy(&w, p, 8);
+        crc = __crc32cd(crc, w);
     }
+    while (n--) crc = __crc32cb(crc, *p++);
+    return crc;
+}
+static int crc32c_hw_available(void) { return 1; }
+#else
+static unsigned int crc32c_hw(unsigned int crc, const unsigned char *p, size_t n) { return crc32c_sw(crc, p, n); }
+static int crc32c_hw_available(void) { return 0; }
+#endif
+static unsigned int crc32c(const void *buf, size_t n) {
+    static int hw = -1;
+    if (hw < 0) hw = crc32c_hw_available();
+    unsigned int crc = 0xFFFFFFFFu;
+    crc = hw ? crc32c_hw(crc, buf, n) : crc32c_sw(crc, buf, n);
+    return crc ^ 0xFFFFFFFFu;
 }
 
-/* Sorting helpers */
-static int cmp_title(const void *a, const void *b) {
-    const Track *ta = a, *tb = b;
-    return strcasecmp(ta->title, tb->title);
+static void put_u16(unsigned char *p, unsigned int v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put_u32(unsigned char *p, unsigned int v) {
+    for (int i = 0; i < 4; ++i) p[i] = (unsigned char)(v >> (8 * i));
 }
-static int cmp_artist(const void *a, const void *b) {
-    const Track *ta = a, *tb = b;
-    int r = strcasecmp(ta->artist, tb->artist);
-    if (r != 0) return r;
-    return strcasecmp(ta->title, tb->title);
+static void put_u64(unsigned char *p, unsigned long long v) {
+    for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
 }
-static int cmp_duration(const void *a, const void *b) {
-    const Track *ta = a, *tb = b;
-    return ta->duration - tb->duration;
+static unsigned int get_u16(const unsigned char *p) { return (unsigned int)p[0] | (unsigned int)p[1] << 8; }
+static unsigned int get_u32(const unsigned char *p) {
+    return (unsigned int)p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
+static unsigned long long get_u64(const unsigned char *p) {
+    return (unsigned long long)get_u32(p) | (unsigned long long)get_u32(p + 4) << 32;
 }
 
-/* Play simulation: prints and sleeps briefly (duration limited for demo) */
-static void play_track(const Track *t) {
-    int demo_seconds = t->duration < 6 ? t->duration : 5; /* don't actually wait full song */
-    printf("Now playing: %s — %s [%d:%02d]  (demo %d sec)\n",
-           t->title, t->artist, t->duration/60, t->duration%60, demo_seconds);
-    fflush(stdout);
-    sleep(demo_seconds);
+/* Growable byte buffer */
+typedef struct {
+    unsigned char *data;
+    size_t len, cap;
+} ByteBuf;
+static unsigned char *buf_grow(ByteBuf *b, size_t n) {
+    if (b->len + n > b->cap) {
+        size_t cap = b->cap ? b->cap : 4096;
+        while (cap < b->len + n) cap *= 2;
+        b->data = realloc(b->data, cap);
+        if (!b->data) { perror("realloc"); exit(1); }
+        b->cap = cap;
+    }
+    unsigned char *p = b->data + b->len;
+    b->len += n;
+    return p;
+}
+static void buf_put_u32(ByteBuf *b, unsigned int v) { put_u32(buf_grow(b, 4), v); }
+static void buf_put_str(ByteBuf *b, const char *s) {
+    size_t n = strlen(s);
+    buf_put_u32(b, (unsigned int)n);
+    memcpy(buf_grow(b, n), s, n);
 }
 
-/* Interactive menu */
-static void print_help(void) {
-    puts("\nCommands:");
-    puts(" add        - add a new track");
-    puts(" list       - list all tracks");
-    puts(" remove N   - remove track at index N (1-based)");
-    puts(" search X   - search title/artist/album for X");
-    puts(" shuffle    - shuffle playlist");
-    puts(" sort title - sort by title");
-    puts(" sort artist- sort by artist then title");
-    puts(" sort dur   - sort by duration ascending");
-    puts(" play N     - play track N (simulated)");
-    puts(" save [f]   - save playlist to file (default: playlist.csv)");
-    puts(" load [f]   - load playlist from file and append (default: playlist.csv)");
-    puts(" clear      - clear playlist (destructive)");
-    puts(" help       - show this help");
-    puts(" quit       - save and exit\n");
+static void buf_put_meta(ByteBuf *b, const MetaColumns *m, unsigned int id) {
+    char buf[32];
+    for (int k = 0; k < META_NFIELDS; ++k) {
+        if (k == META_GENRE || k == META_PATH) buf_put_str(b, meta_text(m, id, (MetaField)k, buf, sizeof(buf)));
+        else if (k == META_LAST_PLAYED) put_u64(buf_grow(b, 8), (unsigned long long)meta_num(m, id, (MetaField)k));
+        else buf_put_u32(b, (unsigned int)meta_num(m, id, (MetaField)k));
+    }
 }
 
-/* Parse integer from token, return -1 if invalid */
-static int parse_index_token(const char *tok, int max) {
-    if (!tok) return -1;
-    char *end; long v = strtol(tok, &end, 10);
-    if (*end != '\0' || v < 1 || v > max) return -1;
-    return (int)v - 1;
+static int has_suffix(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcasecmp(s + n - m, suffix) == 0;
 }
 
-int main(void) {
-    Playlist pl;
-    init_playlist(&pl);
+static int write_playlist_bin(const Playlist *pl, FILE *f) {
+    unsigned char hdr[PLB_HEADER_LEN] = {'P', 'L', 'B', 'F'};
+    put_u16(hdr + 4, PLB_VERSION);
+    put_u16(hdr + 6, PLB_HEADER_LEN);
+    put_u32(hdr + 8, pl->meta.rows ? PLB_FIELDS : PLB_BASE_FIELDS);
+    put_u32(hdr + 12, PLB_BLOCK_TRACKS);
+    put_u32(hdr + 28, crc32c(hdr, 28));
+    fwrite(hdr, 1, sizeof(hdr), f);
 
-    /* try loading default file */
-    load_playlist_csv(&pl, DEFAULT_SAVE);
+    ByteBuf block = {0}, index = {0};
+    unsigned long long off = PLB_HEADER_LEN;
+    unsigned int nblocks = 0;
+    for (size_t start = 0; start < pl->size; start += PLB_BLOCK_TRACKS) {
+        size_t end = start + PLB_BLOCK_TRACKS < pl->size ? start + PLB_BLOCK_TRACKS : pl->size;
+        block.len = 0;
+        for (size_t i = start; i < end; ++i) {
+            const Track *t = &pl->items[i];
+            size_t rec = block.len;
+            buf_put_u32(&block, 0);
+            buf_put_str(&block, t->title);
+            buf_put_str(&block, t->artist);
+            buf_put_str(&block, t->album);
+            buf_put_u32(&block, (unsigned int)t->duration);
+            if (pl->meta.rows) buf_put_meta(&block, &pl->meta, t->id);
+            put_u32(block.data + rec, (unsigned int)(block.len - rec - 4));
+        }
+        unsigned int crc = crc32c(block.data, block.len);
+        unsigned char bh[PLB_BLOCK_HDR_LEN] = {'P', 'L', 'B', 'K'};
+        put_u32(bh + 4, (unsigned int)(end - start));
+        put_u32(bh + 8, (unsigned int)block.len);
+        put_u32(bh + 12, crc);
+        fwrite(bh, 1, sizeof(bh), f);
+        fwrite(block.data, 1, block.len, f);
+        unsigned char *e = buf_grow(&index, PLB_INDEX_ENTRY_LEN);
+        put_u64(e, off);
+        put_u32(e + 8, (unsigned int)(end - start));
+        put_u32(e + 12, crc);
+        off += PLB_BLOCK_HDR_LEN + block.len;
+        nblocks++;
+    }
+    if (index.len) fwrite(index.data, 1, index.len, f);
+    unsigned char tr[PLB_TRAILER_LEN];
+    put_u64(tr, off);
+    put_u32(tr + 8, nblocks);
+    put_u32(tr + 12, crc32c(index.data ? index.data : tr, index.len));
+    memcpy(tr + 16, "PLBE", 4);
+    put_u32(tr + 20, crc32c(tr, 20));
+    fwrite(tr, 1, sizeof(tr), f);
+    free(block.data); free(index.data);
+    return !ferror(f);
+}
 
-    printf("Music Playlist Manager — simple and presentable\n");
-    printf("Type 'help' for commands. Starting with %zu tracks loaded.\n", pl.size);
+static char *read_whole_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return NULL;
+    ByteBuf b = {0};
+    size_t n;
+    do {
+        unsigned char *p = buf_grow(&b, 1 << 16);
+        n = fread(p, 1, 1 << 16, f);
+        b.len -= (1 << 16) - n;
+    } while (n > 0);
+    fclose(f);
+    *len = b.len;
+    return (char *)b.data;
+}
+static char *read_bin_str(const unsigned char **p, const unsigned char *end) {
+    if (end - *p < 4) return NULL;
+    size_t n = get_u32(*p);
+    if ((size_t)(end - *p - 4) < n) return NULL;
+    char *s = strndup((const char *)*p + 4, n);
+    if (!s) { perror("strndup"); exit(1); }
+    *p += 4 + n;
+    return s;
+}
+/* Reads metadata field f of a record into row id; out-of-range values are
+   dropped, a truncated field fails */
+static int read_bin_meta(MetaColumns *m, unsigned int id, MetaField f, const unsigned char **p, const unsigned char *end) {
+    if (f == META_GENRE || f == META_PATH) {
+        char *s = read_bin_str(p, end);
+        if (!s) return 0;
+        meta_set(m, id, f, s);
+        free(s);
+        return 1;
+    }
+    size_t w = f == META_LAST_PLAYED ? 8 : 4;
+    if ((size_t)(end - *p) < w) return 0;
+    meta_set_num(m, id, f, w == 8 ? (long long)get_u64(*p) : (long long)get_u32(*p));
+    *p += w;
+    return 1;
+}
+/* Parses one verified block; returns 0 (adding nothing) if it is malformed */
+static int parse_bin_block(Playlist *pl, const unsigned char *p, size_t len, unsigned int ntracks, unsigned int fields) {
+    const unsigned char *end = p + len;
+    size_t first = pl->size;
+    for (unsigned int r = 0; r < ntracks; ++r) {
+        if (end - p < 4 || (size_t)(end - p - 4) < get_u32(p)) goto bad;
+        const unsigned char *rec_end = p + 4 + get_u32(p);
+        p += 4;
+        char *str[3] = {NULL, NULL, NULL};
+        int dur = 0, ok = 1;
+        for (unsigned int fi = 0; ok && fi < fields && fi < PLB_BASE_FIELDS; ++fi) {
+            if (fi < 3) ok = (str[fi] = read_bin_str(&p, rec_end)) != NULL;
+            else if ((ok = rec_end - p >= 4)) { dur = (int)get_u32(p); p += 4; }
+        }
+        if (!ok) { free(str[0]); free(str[1]); free(str[2]); goto bad; }
+        for (int k = 0; k < 3; ++k) if (!str[k]) str[k] = strdup_safe("");
+        add_track_owned(pl, str[0], str[1], str[2], dur);
+        for (unsigned int fi = PLB_BASE_FIELDS; fi < fields && fi < PLB_FIELDS; ++fi)
+            if (!read_bin_meta(&pl->meta, pl->items[pl->size - 1].id, (MetaField)(fi - PLB_BASE_FIELDS), &p, rec_end)) goto bad;
+        p = rec_end; /* skip fields from newer versions */
+    }
+    return 1;
+bad:
+    while (pl->size > first) drop_track(pl, &pl->items[--pl->size]);
+    return 0;
+}
+static int traced_bin_block(Playlist *pl, const unsigned char *p, size_t len, unsigned int ntracks, unsigned int fields) {
+    double span = trace_begin();
+    int ok = parse_bin_block(pl, p, len, ntracks, fields);
+    trace_end("block parse", span, ntracks);
+    return ok;
+}
+static int load_playlist_bin(Playlist *pl, const char *path) {
+    size_t len;
+    unsigned char *data = (unsigned char *)read_whole_file(path, &len);
+    if (!data) return 0;
+    if (len < PLB_HEADER_LEN || memcmp(data, "PLBF", 4) != 0 || get_u32(data + 28) != crc32c(data, 28) ||
+        get_u16(data + 4) > PLB_VERSION || get_u16(data + 6) < PLB_HEADER_LEN || get_u16(data + 6) > len) {
+        free(data);
+        return 0;
+    }
+    unsigned int fields = get_u32(data + 8);
+    size_t header_len = get_u16(data + 6), skipped = 0;
+    const unsigned char *tr = len >= header_len + PLB_TRAILER_LEN ? data + len - PLB_TRAILER_LEN : NULL;
+    int indexed = tr && memcmp(tr + 16, "PLBE", 4) == 0 && get_u32(tr + 20) == crc32c(tr, 20);
+    unsigned long long index_off = indexed ? get_u64(tr) : 0;
+    unsigned int nblocks = indexed ? get_u32(tr + 8) : 0;
+    if (indexed && (index_off < header_len || index_off > len - PLB_TRAILER_LEN ||
+                    (len - PLB_TRAILER_LEN - index_off) != (unsigned long long)nblocks * PLB_INDEX_ENTRY_LEN ||
+                    get_u32(tr + 12) != crc32c(data + index_off, (size_t)nblocks * PLB_INDEX_ENTRY_LEN)))
+        indexed = 0;
+    if (indexed) {
+        for (unsigned int b = 0; b < nblocks; ++b) {
+            const unsigned char *e = data + index_off + (size_t)b * PLB_INDEX_ENTRY_LEN;
+            /* off comes from the file: compare by subtraction so a huge value cannot wrap */
+            unsigned long long off = get_u64(e);
+            int ok = off >= header_len && off < index_off && index_off - off >= PLB_BLOCK_HDR_LEN;
+            const unsigned char *bh = ok ? data + off : NULL;
+            ok = ok && memcmp(bh, "PLBK", 4) == 0 && get_u32(bh + 8) <= index_off - off - PLB_BLOCK_HDR_LEN &&
+                 get_u32(bh + 12) == get_u32(e + 12) &&
+                 crc32c(bh + PLB_BLOCK_HDR_LEN, get_u32(bh + 8)) == get_u32(bh + 12);
+            if (!ok || !traced_bin_block(pl, bh + PLB_BLOCK_HDR_LEN, get_u32(bh + 8), get_u32(bh + 4), fields)) {
+                fprintf(stderr, "%s: skipping corrupt block %u\n", path, b);
+                skipped++;
+            }
+        }
+    } else {
+        /* no usable index: walk blocks from the header, resyncing on the block magic */
+        fprintf(stderr, "%s: index damaged, scanning for blocks\n", path);
+        size_t off = header_len;
+        while (off < len && len - off >= PLB_BLOCK_HDR_LEN) {
+            const unsigned char *bh = data + off;
+            if (memcmp(bh, "PLBK", 4) != 0) { off++; continue; }
+            size_t plen = get_u32(bh + 8);
+            if (plen <= len - off - PLB_BLOCK_HDR_LEN && crc32c(bh + PLB_BLOCK_HDR_LEN, plen) == get_u32(bh + 12) &&
+                traced_bin_block(pl, bh + PLB_BLOCK_HDR_LEN, plen, get_u32(bh + 4), fields)) {
+                off += PLB_BLOCK_HDR_LEN + plen;
+            } else {
+                skipped++;
+                off++;
+            }
+        }
+    }
+    if (skipped) fprintf(stderr, "%s: %zu corrupt block(s) skipped\n", path, skipped);
+    free(data);
+    return 1;
+}
 
-    char cmdline[MAX_LINE];
+/* Durability. Saves always go to a temp file that is renamed over the
+   target, so a crash leaves either the old or the new file. Policy:
+     always  - fsync the file before rename and the directory after it;
+               fsync the journal after every record
+     batched - same for saves; the journal is fsynced once per group of
+               JOURNAL_GROUP records or JOURNAL_GROUP_SEC, whichever is first
+     never   - no fsync at all (atomic against process crashes only) */
+typedef enum { FSYNC_ALWAYS, FSYNC_BATCHED, FSYNC_NEVER } FsyncPolicy;
+static FsyncPolicy g_fsync_policy = FSYNC_ALWAYS;
+static const char *const fsync_policy_names[] = {"always", "batched", "never"};
+
+static int sync_fd(int fd) {
+#if defined(__APPLE__)
+    if (fcntl(fd, F_FULLFSYNC) == 0) return 0;
+    return fsync(fd);
+#elif defined(__linux__)
+    return fdatasync(fd);
+#else
+    return fsync(fd);
+#endif
+}
+static void parent_dir(char *dir, size_t n, const char *path) {
+    const char *slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, n, ".");
+    else if (slash == path) snprintf(dir, n, "/");
+    else snprintf(dir, n, "%.*s", (int)(slash - path), path);
+}
+static void sync_parent_dir(const char *path) {
+    char dir[MAX_LINE];
+    parent_dir(dir, sizeof(dir), path);
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return;
+    fsync(fd);
+    close(fd);
+}
+
+/* Scratch space for data that may not fit in memory: in dir if given, else
+   under $TMPDIR if set, else beside the file it is derived from (tmpfile()
+   uses /tmp, often a RAM-backed tmpfs). Unlinked at once, so it goes away
+   when closed. Returns NULL (reported) if it cannot be created. */
+static FILE *scratch_file(const char *dir_opt, const char *near) {
+    char dir[MAX_LINE], path[MAX_LINE + 32];
+    const char *env = getenv("TMPDIR");
+    if (dir_opt) snprintf(dir, sizeof(dir), "%s", dir_opt);
+    else if (env && *env) snprintf(dir, sizeof(dir), "%s", env);
+    else parent_dir(dir, sizeof(dir), near);
+    snprintf(path, sizeof(path), "%s/.playlist-scratch-XXXXXX", dir);
+    int fd = mkstemp(path);
+    if (fd < 0) { perror(dir); return NULL; }
+    unlink(path);
+    FILE *f = fdopen(fd, "w+b");
+    if (!f) { perror("fdopen"); close(fd); }
+    return f;
+}
+
+/* Atomic replace: write to the file returned by atomic_begin, then
+   atomic_finish syncs it (per policy), renames it over path and syncs the
+   directory, or discards it if anything failed. tmp needs MAX_LINE + 32. */
+static FILE *atomic_begin(const char *path, char *tmp) {
+    snprintf(tmp, MAX_LINE + 32, "%s.tmp%ld", path, (long)getpid());
+    return fopen(tmp, "wb");
+}
+static int atomic_finish(FILE *f, const char *tmp, const char *path, int ok) {
+    if (fflush(f) != 0 || ferror(f)) ok = 0;
+    if (ok && g_fsync_policy != FSYNC_NEVER && sync_fd(fileno(f)) != 0) ok = 0;
+    if (fclose(f) != 0) ok = 0;
+    if (ok && rename(tmp, path) != 0) ok = 0;
+    if (!ok) { unlink(tmp); return 0; }
+    if (g_fsync_policy != FSYNC_NEVER) sync_parent_dir(path);
+    return 1;
+}
+
+/* Format dispatch: *.plb saves binary; loads detect the magic */
+static int save_playlist(const Playlist *pl, const char *path) {
+    TRACE2(save__start, path, pl->size);
+    double t0 = TRACE_CLOCK(save__done), span = trace_begin();
+    char tmp[MAX_LINE + 32];
+    FILE *f = atomic_begin(path, tmp);
+    int ok = 0;
+    if (f) {
+        double write = trace_begin();
+        ok = has_suffix(path, ".plb") ? write_playlist_bin(pl, f) : write_playlist_csv(pl, f);
+        trace_end("save write", write, (long long)pl->size);
+        double flush = trace_begin();
+        ok = atomic_finish(f, tmp, path, ok);
+        trace_end("save flush", flush, -1);
+    }
+    trace_end("save", span, (long long)pl->size);
+    TRACE4(save__done, path, pl->size, ok, TRACE_NS(save__done, t0));
+    return ok;
+}
+static int load_playlist_any(Playlist *pl, const char *path) {
+    FILE *f = fopen(path, "rb");
+    if (!f) return 0;
+    char magic[4] = {0};
+    size_t n = fread(magic, 1, 4, f);
+    fclose(f);
+    if (n == 4 && memcmp(magic, "PLBF", 4) == 0) return load_playlist_bin(pl, path);
+    return load_playlist_csv(pl, path);
+}
+static int load_playlist(Playlist *pl, const char *path) {
+    TRACE1(load__start, path);
+    double t0 = TRACE_CLOCK(load__done), span = trace_begin();
+    int ok = load_playlist_any(pl, path);
+    trace_end("load", span, (long long)pl->size);
+    TRACE4(load__done, path, pl->size, ok, TRACE_NS(load__done, t0));
+    return ok;
+}
+
+/* Append-only log with group commit under the fsync policy */
+typedef struct {
+    FILE *f;
+    unsigned int pending;  /* records written since the last fsync */
+    double first_pending;  /* when the oldest of them was written */
+} AppendLog;
+
+static int log_open(AppendLog *lg, const char *path) {
+    lg->f = fopen(path, "ab");
+    lg->pending = 0;
+    return lg->f != NULL;
+}
+static void log_commit(AppendLog *lg) {
+    if (!lg->f) return;
+    fflush(lg->f);
+    if (lg->pending && g_fsync_policy != FSYNC_NEVER) sync_fd(fileno(lg->f));
+    lg->pending = 0;
+}
+/* Call after writing each record */
+static void log_appended(AppendLog *lg) {
+    if (!lg->f) return;
+    if (lg->pending++ == 0) lg->first_pending = now_sec();
+    if (g_fsync_policy == FSYNC_ALWAYS || lg->pending >= JOURNAL_GROUP) log_commit(lg);
+    else fflush(lg->f);
+}
+/* Commits a batch that has waited longer than JOURNAL_GROUP_SEC */
+static void log_tick(AppendLog *lg) {
+    if (lg->f && lg->pending && now_sec() - lg->first_pending >= JOURNAL_GROUP_SEC) log_commit(lg);
+}
+/* Waits for stdin to become readable, committing a batch whose
+   JOURNAL_GROUP_SEC runs out first, so an idle prompt never holds records
+   un-synced past the deadline the batched policy promises */
+static void log_wait_input(AppendLog *a, AppendLog *b) {
+    AppendLog *logs[2] = {a, b};
+    for (;;) {
+        double due = 0;
+        for (int i = 0; i < 2; ++i)
+            if (logs[i]->f && logs[i]->pending && (!due || logs[i]->first_pending + JOURNAL_GROUP_SEC < due))
+                due = logs[i]->first_pending + JOURNAL_GROUP_SEC;
+        if (!due) return;
+        double left = due - now_sec();
+        if (left > 0) {
+            struct pollfd p = {STDIN_FILENO, POLLIN, 0};
+            int r = poll(&p, 1, (int)(left * 1e3) + 1);
+            if (r > 0 || (r < 0 && errno != EINTR)) return; /* input ready: fgets takes over */
+            if (r < 0) continue;
+        }
+        log_tick(a);
+        log_tick(b);
+    }
+}
+/* Discards the log contents once a durable snapshot covers them */
+static void log_reset(AppendLog *lg) {
+    if (!lg->f) return;
+    fflush(lg->f);
+    if (ftruncate(fileno(lg->f), 0) == 0 && g_fsync_policy != FSYNC_NEVER) sync_fd(fileno(lg->f));
+    lg->pending = 0;
+}
+static void log_close(AppendLog *lg) {
+    log_commit(lg);
+    if (lg->f) fclose(lg->f);
+    lg->f = NULL;
+}
+
+/* Edit journal for the default playlist: add/remove/clear/load since the last
+   save of DEFAULT_SAVE, replayed at startup. Lines are "A,<csv row>",
+   "R,<csv row>" (the removed track, so replay does not depend on order),
+   "M,<csv row with metadata>" (a metadata edit), "C" and "L,<path>" (a
+   load is replayed by re-reading the file). */
+static void journal_track(AppendLog *lg, char op, const Track *t) {
+    if (!lg->f) return;
+    fputc(op, lg->f); fputc(',', lg->f);
+    write_csv_row(lg->f, t);
+    log_appended(lg);
+}
+static void journal_meta(AppendLog *lg, const Playlist *pl, const Track *t) {
+    if (!lg->f) return;
+    fputs("M,", lg->f);
+    write_csv_fields(lg->f, t);
+    write_csv_meta(lg->f, &pl->meta, t->id);
+    fputc('\n', lg->f);
+    log_appended(lg);
+}
+static void journal_line(AppendLog *lg, const char *line) {
+    if (!lg->f) return;
+    fprintf(lg->f, "%s\n", line);
+    log_appended(lg);
+}
+static long find_track_exact(const Playlist *pl, const Track *r) {
+    for (size_t i = 0; i < pl->size; ++i) {
+        const Track *t = &pl->items[i];
+        if (t->duration == r->duration && strcmp(t->title, r->title) == 0 &&
+            strcmp(t->artist, r->artist) == 0 && strcmp(t->album, r->album) == 0) return (long)i;
+    }
+    return -1;
+}
+static size_t replay_journal(Playlist *pl, const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char *line = NULL;
+    size_t cap = 0, applied = 0;
+    ssize_t len;
+    Playlist one;
+    init_playlist(&one);
+    while ((len = getline(&line, &cap, f)) > 0) {
+        if (line[len - 1] != '\n') break; /* torn final record */
+        line[len - 1] = '\0';
+        if (line[0] == 'C') {
+            clear_playlist(pl);
+        } else if (line[0] == 'L' && line[1] == ',') {
+            load_playlist(pl, line + 2);
+        } else if (line[0] == 'A' && line[1] == ',') {
+            parse_csv_line(pl, line + 2);
+        } else if ((line[0] == 'R' || line[0] == 'M') && line[1] == ',' && parse_csv_line(&one, line + 2)) {
+            long i = find_track_exact(pl, &one.items[0]);
+            if (i >= 0 && line[0] == 'R') remove_track_at(pl, (size_t)i);
+            else if (i >= 0) meta_copy_row(&pl->meta, pl->items[i].id, &one.meta, one.items[0].id);
+            clear_playlist(&one);
+            one.next_id = 1;
+        } else {
+            continue;
+        }
+        applied++;
+    }
+    free_playlist(&one);
+    free(line);
+    fclose(f);
+    return applied;
+}
+
+/* Print helpers */
+static void print_track(const Track *t, size_t idx) {
+    int mins = t->duration / 60;
+    int secs = t->duration % 60;
+    printf("%3zu) %s\n     Artist: %s  Album: %s  Duration: %d:%02d\n",
+           idx+1, t->title, t->artist, t->album, mins, secs);
+}
+static void list_playlist(const Playlist *pl) {
+    if (pl->size == 0) { printf("Playlist is empty.\n"); return; }
+    for (size_t i = 0; i < pl->size; ++i) {
+        prefetch_track(pl->items, i, pl->size);
+        print_track(&pl->items[i], i);
+    }
+}
+
+/* Search (case-insensitive substring) */
+static int track_matches(const Track *t, const char *term) {
+    return strcasestr(t->title, term) || strcasestr(t->artist, term) || strcasestr(t->album, term);
+}
+
+/* Node-local partitioning: worker i owns the i-th contiguous chunk of the
+   track array and runs on node i % nodes, both when first-touching the chunk
+   (synthetic build, rehome after load) and when scanning it. */
+typedef struct {
+    Track *items;        /* chunk source */
+    Track *dst;          /* rehome target */
+    size_t lo, hi;
+    int node;
+    const char *term;
+    unsigned char *hits; /* per-track match flags */
+    size_t nhits;
+} ScanJob;
+
+static void *scan_worker(void *arg) {
+    ScanJob *job = arg;
+    double span = trace_begin();
+    bind_to_node(job->node);
+    for (size_t i = job->lo; i < job->hi; ++i) {
+        prefetch_track(job->items, i, job->hi);
+        int m = track_matches(&job->items[i], job->term);
+        if (job->hits) job->hits[i] = (unsigned char)m;
+        job->nhits += (size_t)m;
+    }
+    trace_end("scan chunk", span, (long long)(job->hi - job->lo));
+    return NULL;
+}
+static void *rehome_worker(void *arg) {
+    ScanJob *job = arg;
+    double span = trace_begin();
+    bind_to_node(job->node);
+    for (size_t i = job->lo; i < job->hi; ++i) {
+        const Track *src = &job->items[i];
+        Track *t = &job->dst[i];
+        t->title = strdup_safe(src->title);
+        t->artist = strdup_safe(src->artist);
+        t->album = strdup_safe(src->album);
+        t->duration = src->duration;
+        t->id = src->id;
+    }
+    trace_end("rehome chunk", span, (long long)(job->hi - job->lo));
+    return NULL;
+}
+
+/* Deterministic synthetic track i, used by the benchmarks */
+static void synth_track(Track *t, size_t i) {
+    static const char *const words[16] = {
+        "love", "night", "blue", "fire", "dream", "city", "heart", "rain",
+        "gold", "road", "light", "wild", "summer", "ghost", "river", "star"
+    };
+    unsigned long long h = (unsigned long long)i * 0x9E3779B97F4A7C15ull;
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%s %s %zu", words[h >> 60], words[(h >> 56) & 15], i);
+    t->title = strdup_safe(buf);
+    snprintf(buf, sizeof(buf), "Artist %llu", (h >> 20) % 5000);
+    t->artist = strdup_safe(buf);
+    snprintf(buf, sizeof(buf), "Album %llu", (h >> 8) % 20000);
+    t->album = strdup_safe(buf);
+    t->duration = 90 + (int)((h >> 32) % 400);
+    t->id = (unsigned int)i + 1;
+}
+static void *synth_worker(void *arg) {
+    ScanJob *job = arg;
+    double span = trace_begin();
+    bind_to_node(job->node);
+    for (size_t i = job->lo; i < job->hi; ++i) synth_track(&job->items[i], i);
+    trace_end("synth chunk", span, (long long)(job->hi - job->lo));
+    return NULL;
+}
+
+/* Runs fn over nthreads node-local chunks of items[0..n); returns total hits */
+static size_t run_partitioned(Track *items, size_t n, size_t nthreads, void *(*fn)(void *),
+                              Track *dst, const char *term, unsigned char *hits) {
+    ScanJob jobs[MAX_SCAN_THREADS];
+    pthread_t tids[MAX_SCAN_THREADS];
+    int nodes = numa_node_count();
+    if (nthreads > MAX_SCAN_THREADS) nthreads = MAX_SCAN_THREADS;
+    if (nthreads > n) nthreads = n ? n : 1;
+    size_t per = n / nthreads, extra = n % nthreads, lo = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        ScanJob *j = &jobs[i];
+        j->items = items; j->dst = dst; j->term = term; j->hits = hits; j->nhits = 0;
+        j->node = (int)(i % (size_t)nodes);
+        j->lo = lo; j->hi = lo + per + (i < extra ? 1 : 0); lo = j->hi;
+        if (pthread_create(&tids[i], NULL, fn, j) != 0) { perror("pthread_create"); exit(1); }
+    }
+    size_t total = 0;
+    for (size_t i = 0; i < nthreads; ++i) {
+        pthread_join(tids[i], NULL);
+        total += jobs[i].nhits;
+    }
+    return total;
+}
+
+/* Re-allocate tracks so each chunk lives on the node that scans it */
+static void numa_rehome(Playlist *pl) {
+    if (numa_node_count() < 2 || pl->size < PAR_SCAN_MIN) return;
+    Track *dst = malloc(pl->cap * sizeof(Track)); /* untouched until workers write */
+    if (!dst) { perror("malloc"); exit(1); }
+    run_partitioned(pl->items, pl->size, scan_thread_count(), rehome_worker, dst, NULL, NULL);
+    for (size_t i = 0; i < pl->size; ++i) release_track(pl, &pl->items[i]);
+    free(pl->items);
+    release_blob(pl);
+    pl->items = dst;
+}
+
+/* String relayout: sort and shuffle leave each track's strings wherever
+   they were allocated, so walking the list in order jumps around the heap.
+   This copies title, artist and album of every track into one blob in the
+   current playlist order and frees the old copies. */
+static int g_relayout_on_load = 1;
+static void pack_strings(Playlist *pl) {
+    double span = trace_begin();
+    size_t len = 0;
+    for (size_t i = 0; i < pl->size; ++i) len += track_str_bytes(&pl->items[i]);
+    char *blob = malloc(len ? len : 1), *p = blob;
+    if (!blob) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < pl->size; ++i) {
+        Track *t = &pl->items[i];
+        char *fields[3] = {t->title, t->artist, t->album};
+        for (int f = 0; f < 3; ++f) {
+            size_t flen = strlen(fields[f]) + 1;
+            memcpy(p, fields[f], flen);
+            fields[f] = p;
+            p += flen;
+        }
+        int dur = t->duration;
+        release_track(pl, t);
+        t->title = fields[0]; t->artist = fields[1]; t->album = fields[2]; t->duration = dur;
+    }
+    release_blob(pl);
+    pl->blob = blob;
+    pl->blob_len = len;
+    pl->blob_tracks = pl->size;
+    pl->str_bytes = len;
+    pl->hole_bytes = 0;
+    trace_end("relayout", span, (long long)pl->size);
+}
+/* After a load: node-local copies when scans are spread over NUMA nodes,
+   otherwise one blob in playlist order */
+static void place_strings(Playlist *pl) {
+    if (numa_node_count() > 1 && pl->size >= PAR_SCAN_MIN) numa_rehome(pl);
+    else if (g_relayout_on_load) pack_strings(pl);
+}
+
+static void search_playlist(const Playlist *pl, const char *term) {
+    TRACE2(search__start, term, pl->size);
+    double t0 = TRACE_CLOCK(search__done);
+    size_t found = 0;
+    if (pl->size >= PAR_SCAN_MIN && scan_thread_count() > 1) {
+        unsigned char *hits = malloc(pl->size);
+        if (!hits) { perror("malloc"); exit(1); }
+        found = run_partitioned(pl->items, pl->size, scan_thread_count(), scan_worker, NULL, term, hits);
+        for (size_t i = 0; i < pl->size; ++i)
+            if (hits[i]) print_track(&pl->items[i], i);
+        free(hits);
+    } else {
+        for (size_t i = 0; i < pl->size; ++i) {
+            prefetch_track(pl->items, i, pl->size);
+            if (track_matches(&pl->items[i], term)) { print_track(&pl->items[i], i); found++; }
+        }
+    }
+    if (!found) printf("No matches for \"%s\".\n", term);
+    TRACE4(search__done, term, pl->size, found, TRACE_NS(search__done, t0));
+}
+
+/* Column-only filter: each "field<op>value" term of expr is one pass over
+   that field's metadata column into a per-id mask, and the tracks are then
+   visited once to print the survivors in playlist order. Returns the number
+   of matches, or -1 if expr does not parse. */
+static long filter_playlist(const Playlist *pl, const char *expr) {
+    size_t n = pl->next_id;
+    unsigned char *mask = malloc(n);
+    if (!mask) { perror("malloc"); exit(1); }
+    memset(mask, 1, n);
+    const char *s = expr;
+    int terms = 0;
+    for (;;) {
+        while (*s == ' ') s++;
+        if (!*s) break;
+        size_t flen = strcspn(s, "=!<>~ ");
+        int f = meta_field_lookup(s, flen);
+        RuleOp op;
+        s += flen;
+        if (f < 0 || !parse_rule_op(&s, &op)) goto bad;
+        char *v = parse_rule_value(&s);
+        if (!v) goto bad;
+        int ok = meta_scan_term(&pl->meta, (MetaField)f, op, v, mask, n);
+        free(v);
+        if (!ok) goto bad;
+        terms++;
+    }
+    if (!terms) goto bad;
+    long hits = 0;
+    for (size_t i = 0; i < pl->size; ++i)
+        if (mask[pl->items[i].id]) { print_track(&pl->items[i], i); hits++; }
+    free(mask);
+    return hits;
+bad:
+    free(mask);
+    return -1;
+}
+
+/* Scan bandwidth with 1..T threads, for a single-thread-built playlist and
+   one first-touched by node-local workers */
+static void bench_scan(size_t n) {
+    size_t threads = scan_thread_count();
+    printf("bench scan: %zu tracks, %zu threads, %d NUMA node(s)\n", n, threads, numa_node_count());
+    for (int local = 0; local < 2; ++local) {
+        Playlist pl;
+        init_playlist(&pl);
+        free(pl.items);
+        pl.items = malloc(n * sizeof(Track));
+        if (!pl.items) { perror("malloc"); exit(1); }
+        pl.cap = pl.size = n;
+        run_partitioned(pl.items, n, local ? threads : 1, synth_worker, NULL, NULL, NULL);
+        size_t bytes = n * sizeof(Track);
+        for (size_t i = 0; i < n; ++i)
+            bytes += strlen(pl.items[i].title) + strlen(pl.items[i].artist) + strlen(pl.items[i].album) + 3;
+        printf(" %s-built:\n", local ? "node-local" : "single-thread");
+        for (size_t t = 1;; t = (t * 2 > threads) ? threads : t * 2) {
+            double best = 1e30;
+            for (int rep = 0; rep < 3; ++rep) {
+                double t0 = now_sec();
+                run_partitioned(pl.items, n, t, scan_worker, NULL, "\x01", NULL);
+                double dt = now_sec() - t0;
+                if (dt < best) best = dt;
+            }
+            printf("  %2zu threads: %8.3f ms  %8.1f MB/s\n", t, best * 1e3, (double)bytes / best / 1e6);
+            if (t == threads) break;
+        }
+        free_playlist(&pl);
+    }
+}
+
+/* Shuffle: Fisher-Yates */
+static void shuffle_playlist(Playlist *pl) {
+    if (pl->size < 2) return;
+    TRACE1(shuffle__start, pl->size);
+    double t0 = TRACE_CLOCK(shuffle__done);
+    srand((unsigned int)time(NULL));
+    for (size_t i = pl->size - 1; i > 0; --i) {
+        size_t j = rand() % (i + 1);
+        Track tmp = pl->items[i];
+        pl->items[i] = pl->items[j];
+        pl->items[j] = tmp;
+    }
+    TRACE2(shuffle__done, pl->size, TRACE_NS(shuffle__done, t0));
+}
+
+/* Sorting helpers */
+static int cmp_title(const void *a, const void *b) {
+    const Track *ta = a, *tb = b;
+    return strcasecmp(ta->title, tb->title);
+}
+static int cmp_artist(const void *a, const void *b) {
+    const Track *ta = a, *tb = b;
+    int r = strcasecmp(ta->artist, tb->artist);
+    if (r != 0) return r;
+    return strcasecmp(ta->title, tb->title);
+}
+static int cmp_duration(const void *a, const void *b) {
+    const Track *ta = a, *tb = b;
+    return ta->duration - tb->duration;
+}
+
+/* Key-gathered sort: one prefetched pass pulls each track's sort key (and an
+   8-byte case-folded prefix of it) into a compact array, so most comparisons
+   never touch the string heap; the tracks are then permuted once. */
+typedef enum { SORT_TITLE, SORT_ARTIST, SORT_DURATION } SortKind;
+typedef struct {
+    unsigned long long prefix; /* big-endian, compares like strcasecmp */
+    const Track *t;
+} SortKey;
+
+static unsigned long long fold_prefix(const char *s) {
+    unsigned long long k = 0;
+    for (int i = 0; i < 8; ++i) {
+        unsigned char c = (unsigned char)*s;
+        if (c) s++;
+        k = (k << 8) | (unsigned char)tolower(c);
+    }
+    return k;
+}
+static void gather_sort_keys(const Track *items, size_t n, SortKind kind, SortKey *keys) {
+    for (size_t i = 0; i < n; ++i) {
+        const Track *t = &items[i];
+        if (g_prefetch && i + PREFETCH_DIST < n) {
+            const Track *ahead = &items[i + PREFETCH_DIST];
+            PREFETCH(kind == SORT_ARTIST ? ahead->artist : ahead->title);
+        }
+        keys[i].t = t;
+        if (kind == SORT_TITLE) keys[i].prefix = fold_prefix(t->title);
+        else if (kind == SORT_ARTIST) keys[i].prefix = fold_prefix(t->artist);
+        else keys[i].prefix = (unsigned long long)(unsigned int)t->duration ^ 0x80000000u;
+    }
+}
+static int cmp_key_title(const void *a, const void *b) {
+    const SortKey *ka = a, *kb = b;
+    if (ka->prefix != kb->prefix) return ka->prefix < kb->prefix ? -1 : 1;
+    return cmp_title(ka->t, kb->t);
+}
+static int cmp_key_artist(const void *a, const void *b) {
+    const SortKey *ka = a, *kb = b;
+    if (ka->prefix != kb->prefix) return ka->prefix < kb->prefix ? -1 : 1;
+    return cmp_artist(ka->t, kb->t);
+}
+static int cmp_key_prefix(const void *a, const void *b) {
+    const SortKey *ka = a, *kb = b;
+    return (ka->prefix > kb->prefix) - (ka->prefix < kb->prefix);
+}
+
+/* DEFINE_SORT(name, T, LESS) defines static void name(T *a, size_t n), an
+   introsort (median-of-3 quicksort, heapsort past 2*log2(n) levels,
+   insertion sort for small ranges) in which LESS(x, y), on two T pointers,
+   is expanded in place rather than called through qsort's function pointer.
+   Like qsort it is not stable. It also defines name##_select(a, n, k), an
+   introselect that moves the k least elements, unordered, to a[0..k) in
+   O(n) (heap selection past the same depth limit). */
+#define DEFINE_SORT(name, T, LESS)                                              \
+static void name##_insertion(T *a, size_t n) {                                 \
+    for (size_t i = 1; i < n; ++i) {                                            \
+        T x = a[i];                                                             \
+        size_t j = i;                                                           \
+        for (; j && LESS(&x, &a[j - 1]); --j) a[j] = a[j - 1];                  \
+        a[j] = x;                                                               \
+    }                                                                           \
+}                                                                               \
+static void name##_sift(T *a, size_t i, size_t n) {                             \
+    T x = a[i];                                                                 \
+    for (size_t c; (c = 2 * i + 1) < n; i = c) {                                \
+        if (c + 1 < n && LESS(&a[c], &a[c + 1])) c++;                           \
+        if (!LESS(&x, &a[c])) break;                                            \
+        a[i] = a[c];                                                            \
+    }                                                                           \
+    a[i] = x;                                                                   \
+}                                                                               \
+/* returns left with a[0..left) <= pivot <= a[left..n), 0 < left < n */        \
+static size_t name##_partition(T *a, size_t n) {                                \
+    T *lo = &a[0], *mid = &a[n / 2], *hi = &a[n - 1], x;                        \
+    if (LESS(mid, lo)) { x = *mid; *mid = *lo; *lo = x; }                       \
+    if (LESS(hi, mid)) {                                                        \
+        x = *hi; *hi = *mid; *mid = x;                                          \
+        if (LESS(mid, lo)) { x = *mid; *mid = *lo; *lo = x; }                   \
+    }                                                                           \
+    T pivot = *mid;                                                             \
+    size_t i = 0, j = n - 1;                                                    \
+    for (;;) {                                                                  \
+        while (LESS(&a[i], &pivot)) i++;                                        \
+        while (LESS(&pivot, &a[j])) j--;                                        \
+        if (i >= j) return j + 1;                                               \
+        x = a[i]; a[i++] = a[j]; a[j--] = x;                                    \
+    }                                                                           \
+}                                                                               \
+static void name##_intro(T *a, size_t n, int depth) {                           \
+    while (n > SORT_INSERTION) {                                                \
+        if (depth-- == 0) {                                                     \
+            for (size_t i = n / 2; i-- > 0;) name##_sift(a, i, n);              \
+            for (size_t i = n; i-- > 1;) {                                      \
+                T x = a[0]; a[0] = a[i]; a[i] = x;                              \
+                name##_sift(a, 0, i);                                           \
+            }                                                                   \
+            return;                                                             \
+        }                                                                       \
+        size_t left = name##_partition(a, n);                                   \
+        if (left < n - left) { name##_intro(a, left, depth); a += left; n -= left; } \
+        else { name##_intro(a + left, n - left, depth); n = left; }             \
+    }                                                                           \
+    name##_insertion(a, n);                                                     \
+}                                                                               \
+static void name(T *a, size_t n) {                                              \
+    int depth = 0;                                                              \
+    for (size_t m = n; m > 1; m >>= 1) depth += 2;                              \
+    name##_intro(a, n, depth);                                                  \
+}                                                                               \
+static void name##_select(T *a, size_t n, size_t k) {                           \
+    int depth = 0;                                                              \
+    for (size_t m = n; m > 1; m >>= 1) depth += 2;                              \
+    while (k && k < n && n > SORT_INSERTION) {                                  \
+        if (depth-- == 0) {                                                     \
+            for (size_t i = k / 2; i-- > 0;) name##_sift(a, i, k);              \
+            for (size_t i = k; i < n; ++i) {                                    \
+                if (!LESS(&a[i], &a[0])) continue;                              \
+                T x = a[0]; a[0] = a[i]; a[i] = x;                              \
+                name##_sift(a, 0, k);                                           \
+            }                                                                   \
+            return;                                                             \
+        }                                                                       \
+        size_t left = name##_partition(a, n);                                   \
+        if (k <= left) n = left;                                                \
+        else { a += left; n -= left; k -= left; }                               \
+    }                                                                           \
+    if (k && k < n) name##_insertion(a, n);                                     \
+}
+
+#define KEY_LESS_TITLE(x, y) \
+    ((x)->prefix != (y)->prefix ? (x)->prefix < (y)->prefix : cmp_title((x)->t, (y)->t) < 0)
+#define KEY_LESS_ARTIST(x, y) \
+    ((x)->prefix != (y)->prefix ? (x)->prefix < (y)->prefix : cmp_artist((x)->t, (y)->t) < 0)
+#define KEY_LESS_PREFIX(x, y) ((x)->prefix < (y)->prefix)
+#define KEY_MORE_TITLE(x, y) KEY_LESS_TITLE(y, x)
+#define KEY_MORE_ARTIST(x, y) KEY_LESS_ARTIST(y, x)
+#define KEY_MORE_PREFIX(x, y) KEY_LESS_PREFIX(y, x)
+DEFINE_SORT(sort_keys_title, SortKey, KEY_LESS_TITLE)
+DEFINE_SORT(sort_keys_artist, SortKey, KEY_LESS_ARTIST)
+DEFINE_SORT(sort_keys_prefix, SortKey, KEY_LESS_PREFIX)
+DEFINE_SORT(sort_keys_title_desc, SortKey, KEY_MORE_TITLE)
+DEFINE_SORT(sort_keys_artist_desc, SortKey, KEY_MORE_ARTIST)
+DEFINE_SORT(sort_keys_prefix_desc, SortKey, KEY_MORE_PREFIX)
+/* Stable, linear-time duration sort of src into dst. Durations are small
+   counts of seconds, so one counting pass over [min, max] does it; a range
+   much wider than n (values from a hand-edited file) falls back to LSD
+   radix on the sign-flipped 32-bit value, 8 bits a pass, skipping passes in
+   which every key has the same byte. */
+static void sort_by_duration(const Track *src, Track *dst, size_t n) {
+    int lo = INT_MAX, hi = INT_MIN;
+    for (size_t i = 0; i < n; ++i) {
+        if (src[i].duration < lo) lo = src[i].duration;
+        if (src[i].duration > hi) hi = src[i].duration;
+    }
+    unsigned long long range = n ? (unsigned long long)((long long)hi - lo) + 1 : 0;
+    if (range <= (unsigned long long)n + COUNT_SORT_SLACK) {
+        size_t *start = calloc(range + 1, sizeof(size_t));
+        if (!start) { perror("calloc"); exit(1); }
+        for (size_t i = 0; i < n; ++i) start[(unsigned int)(src[i].duration - lo) + 1]++;
+        for (size_t r = 1; r < range; ++r) start[r] += start[r - 1];
+        for (size_t i = 0; i < n; ++i) dst[start[(unsigned int)(src[i].duration - lo)]++] = src[i];
+        free(start);
+        return;
+    }
+    Track *tmp = malloc(n * sizeof(Track));
+    if (!tmp) { perror("malloc"); exit(1); }
+    const Track *cur = src;
+    for (int shift = 0; shift < 32; shift += 8) {
+        size_t start[257] = {0};
+        for (size_t i = 0; i < n; ++i) start[((((unsigned int)cur[i].duration ^ 0x80000000u) >> shift) & 0xFF) + 1]++;
+        int skip = 0;
+        for (int b = 1; b <= 256; ++b) skip |= start[b] == n;
+        if (skip) continue;
+        for (int b = 1; b < 256; ++b) start[b] += start[b - 1];
+        Track *out = cur == dst ? tmp : dst;
+        for (size_t i = 0; i < n; ++i) out[start[(((unsigned int)cur[i].duration ^ 0x80000000u) >> shift) & 0xFF]++] = cur[i];
+        cur = out;
+    }
+    if (cur != dst) memcpy(dst, cur, n * sizeof(Track));
+    free(tmp);
+}
+static void sort_keys(SortKey *keys, size_t n, SortKind kind) {
+    if (kind == SORT_TITLE) sort_keys_title(keys, n);
+    else if (kind == SORT_ARTIST) sort_keys_artist(keys, n);
+    else sort_keys_prefix(keys, n);
+}
+/* Sorts just the first k of keys in kind order (reversed if desc): the k
+   winners are selected in O(n), then only they are sorted, O(k log k) */
+static void sort_keys_limit(SortKey *keys, size_t n, size_t k, SortKind kind, int desc) {
+    if (k > n) k = n;
+    if (kind == SORT_TITLE && !desc) { sort_keys_title_select(keys, n, k); sort_keys_title(keys, k); }
+    else if (kind == SORT_TITLE) { sort_keys_title_desc_select(keys, n, k); sort_keys_title_desc(keys, k); }
+    else if (kind == SORT_ARTIST && !desc) { sort_keys_artist_select(keys, n, k); sort_keys_artist(keys, k); }
+    else if (kind == SORT_ARTIST) { sort_keys_artist_desc_select(keys, n, k); sort_keys_artist_desc(keys, k); }
+    else if (!desc) { sort_keys_prefix_select(keys, n, k); sort_keys_prefix(keys, k); }
+    else { sort_keys_prefix_desc_select(keys, n, k); sort_keys_prefix_desc(keys, k); }
+}
+static int parse_sort_kind(const char *s, SortKind *kind) {
+    if (strcasecmp(s, "title") == 0) *kind = SORT_TITLE;
+    else if (strcasecmp(s, "artist") == 0) *kind = SORT_ARTIST;
+    else if (strcasecmp(s, "dur") == 0 || strcasecmp(s, "duration") == 0) *kind = SORT_DURATION;
+    else return 0;
+    return 1;
+}
+/* Prints the first k tracks in kind order, with their playlist positions,
+   leaving the playlist as it is */
+static void print_sorted_limit(const Playlist *pl, SortKind kind, int desc, size_t k) {
+    if (pl->size == 0) { printf("Playlist is empty.\n"); return; }
+    size_t n = pl->size;
+    if (k > n) k = n;
+    SortKey *keys = malloc(n * sizeof(SortKey));
+    if (!keys) { perror("malloc"); exit(1); }
+    gather_sort_keys(pl->items, n, kind, keys);
+    sort_keys_limit(keys, n, k, kind, desc);
+    for (size_t i = 0; i < k; ++i) print_track(keys[i].t, (size_t)(keys[i].t - pl->items));
+    free(keys);
+}
+static void sort_playlist(Playlist *pl, SortKind kind) {
+    size_t n = pl->size;
+    if (n < 2) return;
+    TRACE2(sort__start, (int)kind, n);
+    double t0 = TRACE_CLOCK(sort__done), span = trace_begin(), phase = span;
+    Track *sorted = malloc(pl->cap * sizeof(Track));
+    if (!sorted) { perror("malloc"); exit(1); }
+    if (kind == SORT_DURATION) {
+        sort_by_duration(pl->items, sorted, n);
+        trace_end("sort count", phase, (long long)n);
+    } else {
+        SortKey *keys = malloc(n * sizeof(SortKey));
+        if (!keys) { perror("malloc"); exit(1); }
+        gather_sort_keys(pl->items, n, kind, keys);
+        trace_end("sort keys", phase, (long long)n);
+        phase = trace_begin();
+        sort_keys(keys, n, kind);
+        trace_end("sort compare", phase, (long long)n);
+        phase = trace_begin();
+        for (size_t i = 0; i < n; ++i) sorted[i] = *keys[i].t;
+        free(keys);
+        trace_end("sort scatter", phase, (long long)n);
+    }
+    free(pl->items);
+    pl->items = sorted;
+    trace_end("sort", span, (long long)n);
+    TRACE3(sort__done, (int)kind, n, TRACE_NS(sort__done, t0));
+}
+
+/* Scan and sort cost with and without prefetching on a shuffled playlist,
+   whose string data is scattered relative to playlist order */
+static void bench_prefetch(size_t n) {
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    shuffle_playlist(&pl);
+    printf("bench prefetch: %zu tracks (shuffled)\n", n);
+    for (int pf = 0; pf < 2; ++pf) {
+        g_prefetch = pf;
+        double t0 = now_sec();
+        run_partitioned(pl.items, n, 1, scan_worker, NULL, "\x01", NULL);
+        double scan = now_sec() - t0;
+        printf(" prefetch %-3s scan: %8.3f ms  %6.1f ns/track\n", pf ? "on" : "off", scan * 1e3, scan * 1e9 / (double)n);
+    }
+    g_prefetch = 1;
+    Track *copy = malloc(n * sizeof(Track));
+    SortKey *keys = malloc(n * sizeof(SortKey));
+    if (!copy || !keys) { perror("malloc"); exit(1); }
+    static const char *const names[3] = {"title", "artist", "dur"};
+    int (*const direct[3])(const void *, const void *) = {cmp_title, cmp_artist, cmp_duration};
+    int (*const keyed[3])(const void *, const void *) = {cmp_key_title, cmp_key_artist, cmp_key_prefix};
+    for (int k = 0; k < 3; ++k) {
+        memcpy(copy, pl.items, n * sizeof(Track));
+        double t0 = now_sec();
+        qsort(copy, n, sizeof(Track), direct[k]);
+        double t1 = now_sec();
+        gather_sort_keys(pl.items, n, (SortKind)k, keys);
+        qsort(keys, n, sizeof(SortKey), keyed[k]);
+        for (size_t i = 0; i < n; ++i) copy[i] = *keys[i].t;
+        double t2 = now_sec();
+        printf(" sort %-6s qsort(Track): %8.3f ms  gathered keys: %8.3f ms\n", names[k], (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+    }
+    free(copy); free(keys);
+    free_playlist(&pl);
+}
+
+/* Sequential list and search throughput over a shuffled playlist, with
+   strings where they were allocated and after pack_strings */
+static void bench_relayout(size_t n) {
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    shuffle_playlist(&pl);
+    size_t bytes = n * sizeof(Track);
+    for (size_t i = 0; i < n; ++i) bytes += track_str_bytes(&pl.items[i]);
+    printf("bench relayout: %zu tracks (shuffled), %.1f MB\n", n, (double)bytes / 1e6);
+    for (int packed = 0; packed < 2; ++packed) {
+        double pack = 0;
+        if (packed) {
+            double t0 = now_sec();
+            pack_strings(&pl);
+            pack = now_sec() - t0;
+        }
+        double list = 1e30, scan = 1e30;
+        for (int rep = 0; rep < 3; ++rep) {
+            char buf[MAX_LINE];
+            volatile size_t sink = 0; /* keeps the formatting from being optimized out */
+            double t0 = now_sec();
+            for (size_t i = 0; i < n; ++i) {
+                const Track *t = &pl.items[i];
+                sink += (size_t)snprintf(buf, sizeof(buf), "%3zu) %s\n     Artist: %s  Album: %s  Duration: %d:%02d\n",
+                                         i + 1, t->title, t->artist, t->album, t->duration / 60, t->duration % 60);
+            }
+            double t1 = now_sec();
+            run_partitioned(pl.items, n, 1, scan_worker, NULL, "\x01", NULL);
+            double t2 = now_sec();
+            if (t1 - t0 < list) list = t1 - t0;
+            if (t2 - t1 < scan) scan = t2 - t1;
+        }
+        printf(" %-9s list: %8.3f ms %6.1f ns/track   search: %8.3f ms %7.1f MB/s",
+               packed ? "packed" : "scattered", list * 1e3, list * 1e9 / (double)n, scan * 1e3, (double)bytes / scan / 1e6);
+        if (packed) printf("   (relayout %.3f ms)", pack * 1e3);
+        putchar('\n');
+    }
+    free_playlist(&pl);
+}
+
+/* Each sort mode three ways on the same shuffled tracks: qsort over Track
+   with the plain comparator, qsort over gathered keys, and the specialized
+   introsort over gathered keys (what sort uses) */
+static void bench_sort(size_t n) {
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    shuffle_playlist(&pl);
+    Track *copy = malloc(n * sizeof(Track));
+    SortKey *keys = malloc(n * sizeof(SortKey));
+    if (!copy || !keys) { perror("malloc"); exit(1); }
+    static const char *const names[3] = {"title", "artist", "dur"};
+    int (*const direct[3])(const void *, const void *) = {cmp_title, cmp_artist, cmp_duration};
+    int (*const keyed[3])(const void *, const void *) = {cmp_key_title, cmp_key_artist, cmp_key_prefix};
+    printf("bench sort: %zu tracks (shuffled), best of 3\n", n);
+    for (int k = 0; k < 3; ++k) {
+        double best[3] = {1e30, 1e30, 1e30};
+        for (int rep = 0; rep < 3; ++rep) {
+            memcpy(copy, pl.items, n * sizeof(Track));
+            double t0 = now_sec();
+            qsort(copy, n, sizeof(Track), direct[k]);
+            double t1 = now_sec();
+            gather_sort_keys(pl.items, n, (SortKind)k, keys);
+            qsort(keys, n, sizeof(SortKey), keyed[k]);
+            double t2 = now_sec();
+            gather_sort_keys(pl.items, n, (SortKind)k, keys);
+            sort_keys(keys, n, (SortKind)k);
+            double t3 = now_sec();
+            double dt[3] = {t1 - t0, t2 - t1, t3 - t2};
+            for (int m = 0; m < 3; ++m) if (dt[m] < best[m]) best[m] = dt[m];
+        }
+        printf(" %-6s qsort(Track): %8.3f ms  qsort(keys): %8.3f ms  introsort(keys): %8.3f ms  %.2fx\n",
+               names[k], best[0] * 1e3, best[1] * 1e3, best[2] * 1e3, best[1] / best[2]);
+    }
+    /* what sort dur uses: counting sort, and radix once the range is wide */
+    double count = 1e30, radix = 1e30;
+    Track *wide = malloc(n * sizeof(Track));
+    if (!wide) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        wide[i] = pl.items[i];
+        wide[i].duration = pl.items[i].duration * 40009 - 8000000;
+    }
+    for (int rep = 0; rep < 3; ++rep) {
+        double t0 = now_sec();
+        sort_by_duration(pl.items, copy, n);
+        double t1 = now_sec();
+        sort_by_duration(wide, copy, n);
+        double t2 = now_sec();
+        if (t1 - t0 < count) count = t1 - t0;
+        if (t2 - t1 < radix) radix = t2 - t1;
+    }
+    printf(" dur    counting sort: %8.3f ms  %5.1f ns/track   radix (wide range): %8.3f ms  %5.1f ns/track\n",
+           count * 1e3, count * 1e9 / (double)n, radix * 1e3, radix * 1e9 / (double)n);
+    free(wide);
+    free(copy); free(keys);
+    free_playlist(&pl);
+}
+
+/* Cost of a durable save and of journal appends under each fsync policy */
+static void bench_fsync(size_t n) {
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    const char *path = "bench_fsync.csv", *jpath = "bench_fsync.journal";
+    FsyncPolicy saved = g_fsync_policy;
+    printf("bench fsync: save %zu tracks, %d journal appends\n", n, 1000);
+    for (int p = FSYNC_ALWAYS; p <= FSYNC_NEVER; ++p) {
+        g_fsync_policy = (FsyncPolicy)p;
+        double t0 = now_sec();
+        int ok = save_playlist(&pl, path);
+        double t1 = now_sec();
+        AppendLog lg;
+        remove(jpath);
+        if (log_open(&lg, jpath)) {
+            for (size_t i = 0; i < 1000; ++i) journal_track(&lg, 'A', &pl.items[i % n]);
+            log_close(&lg);
+        }
+        double t2 = now_sec();
+        printf(" %-8s save: %9.3f ms%s  journal: %8.2f us/record\n", fsync_policy_names[p],
+               (t1 - t0) * 1e3, ok ? "" : " (failed)", (t2 - t1) * 1e6 / 1000);
+    }
+    g_fsync_policy = saved;
+    remove(path); remove(jpath);
+    free_playlist(&pl);
+}
+
+/* External-memory sort: the input CSV is read in runs that fit the memory
+   budget, each run is sorted in memory and spilled to a scratch file, and the
+   runs are k-way merged (EXTSORT_FANIN at a time) into the output. Merging
+   is tiered while reading: as soon as EXTSORT_FANIN runs of one level are
+   pending they become one run of the next level, so open scratch files stay
+   under EXTSORT_FANIN per level however small the budget. Only one track
+   per run is held in memory while merging. */
+typedef struct {
+    FILE *f;
+    char *line;  /* read buffer, freed at the end of the run */
+    size_t cap;
+    Track cur;
+    int live;
+} RunCursor;
+
+static int (*const sort_track_cmp[3])(const void *, const void *) = {cmp_title, cmp_artist, cmp_duration};
+
+static void run_advance(RunCursor *rc) {
+    if (rc->live) free_track(&rc->cur);
+    rc->live = next_csv_track(rc->f, &rc->line, &rc->cap, &rc->cur);
+}
+/* Ties go to the earlier run; runs stay in input order, so the merge is stable */
+static int run_less(const RunCursor *runs, size_t a, size_t b, int (*cmp)(const void *, const void *)) {
+    int c = cmp(&runs[a].cur, &runs[b].cur);
+    return c < 0 || (c == 0 && a < b);
+}
+static void run_heap_down(RunCursor *runs, size_t *heap, size_t n, size_t i, int (*cmp)(const void *, const void *)) {
+    for (;;) {
+        size_t l = 2 * i + 1, m = i;
+        if (l < n && run_less(runs, heap[l], heap[m], cmp)) m = l;
+        if (l + 1 < n && run_less(runs, heap[l + 1], heap[m], cmp)) m = l + 1;
+        if (m == i) return;
+        size_t tmp = heap[i]; heap[i] = heap[m]; heap[m] = tmp;
+        i = m;
+    }
+}
+/* Merges n sorted run files (closing them) into out; returns rows written */
+static size_t merge_runs(FILE **files, size_t n, FILE *out, SortKind kind) {
+    int (*cmp)(const void *, const void *) = sort_track_cmp[kind];
+    RunCursor *runs = calloc(n, sizeof(RunCursor));
+    size_t *heap = malloc(n * sizeof(size_t)), live = 0, rows = 0;
+    if (!runs || !heap) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        runs[i].f = files[i];
+        rewind(files[i]);
+        run_advance(&runs[i]);
+        if (runs[i].live) heap[live++] = i;
+    }
+    for (size_t i = live; i-- > 0;) run_heap_down(runs, heap, live, i, cmp);
+    while (live) {
+        RunCursor *top = &runs[heap[0]];
+        write_csv_row(out, &top->cur);
+        rows++;
+        run_advance(top);
+        if (!top->live) heap[0] = heap[--live];
+        run_heap_down(runs, heap, live, 0, cmp);
+    }
+    for (size_t i = 0; i < n; ++i) fclose(files[i]);
+    free(runs); free(heap);
+    return rows;
+}
+static FILE *spill_run(Playlist *run, SortKind kind, const char *near) {
+    FILE *f = scratch_file(NULL, near);
+    if (!f) exit(1);
+    sort_playlist(run, kind);
+    for (size_t i = 0; i < run->size; ++i) {
+        write_csv_row(f, &run->items[i]);
+        free_track(&run->items[i]);
+    }
+    run->size = 0;
+    if (fflush(f) != 0) { perror("spill"); exit(1); }
+    return f;
+}
+/* Merges the newest EXTSORT_FANIN runs while they share a level; levels
+   never increase along runs[], so checking the oldest of them is enough */
+static size_t cascade_runs(FILE **runs, unsigned char *level, size_t n, SortKind kind, const char *near) {
+    while (n >= EXTSORT_FANIN && level[n - EXTSORT_FANIN] == level[n - 1]) {
+        FILE *merged = scratch_file(NULL, near);
+        if (!merged) exit(1);
+        merge_runs(runs + n - EXTSORT_FANIN, EXTSORT_FANIN, merged, kind);
+        n -= EXTSORT_FANIN;
+        runs[n] = merged;
+        level[n]++;
+        n++;
+    }
+    return n;
+}
+/* Returns rows written, or -1 if in/out could not be opened */
+static long extsort_csv(const char *in, const char *out, SortKind kind, size_t budget, size_t *nruns) {
+    if (csv_has_meta(in)) return -1;
+    FILE *f = open_csv_rows(in);
+    if (!f) return -1;
+    Playlist run;
+    init_playlist(&run);
+    FILE **runs = NULL;
+    unsigned char *level = NULL;
+    size_t n = 0, cap = 0, used = 0, spilled = 0, lcap = 0;
+    char *line = NULL;
+    Track t;
+    while (next_csv_track(f, &line, &lcap, &t)) {
+        add_track_owned(&run, t.title, t.artist, t.album, t.duration);
+        used += sizeof(Track) + TRACK_OVERHEAD + strlen(t.title) + strlen(t.artist) + strlen(t.album);
+        if (used + run.cap * sizeof(Track) >= budget) {
+            if (n + 1 >= cap) { /* keeps a slot free for the final partial run */
+                cap = cap ? cap * 2 : 16;
+                runs = realloc(runs, cap * sizeof(FILE *));
+                level = realloc(level, cap);
+                if (!runs || !level) { perror("realloc"); exit(1); }
+            }
+            runs[n] = spill_run(&run, kind, out);
+            level[n] = 0;
+            n = cascade_runs(runs, level, n + 1, kind, out);
+            spilled++;
+            used = 0;
+        }
+    }
+    fclose(f);
+    *nruns = spilled + (run.size ? 1 : 0);
+
+    char tmp[MAX_LINE + 32];
+    FILE *o = atomic_begin(out, tmp);
+    if (!o) { for (size_t i = 0; i < n; ++i) fclose(runs[i]); free(runs); free(level); free_playlist(&run); return -1; }
+    fprintf(o, CSV_HEADER "\n");
+    size_t rows = 0;
+    if (n == 0) {
+        /* fits in memory: no spilling */
+        sort_playlist(&run, kind);
+        for (size_t i = 0; i < run.size; ++i) write_csv_row(o, &run.items[i]);
+        rows = run.size;
+    } else {
+        if (run.size) runs[n++] = spill_run(&run, kind, out);
+        while (n > EXTSORT_FANIN) {
+            size_t m = 0;
+            for (size_t i = 0; i < n; i += EXTSORT_FANIN) {
+                size_t k = n - i < EXTSORT_FANIN ? n - i : EXTSORT_FANIN;
+                FILE *merged = scratch_file(NULL, out);
+                if (!merged) exit(1);
+                merge_runs(runs + i, k, merged, kind);
+                runs[m++] = merged;
+            }
+            n = m;
+        }
+        rows = merge_runs(runs, n, o, kind);
+    }
+    free(runs); free(level);
+    free_playlist(&run);
+    return atomic_finish(o, tmp, out, 1) ? (long)rows : -1;
+}
+
+/* Throughput of extsort for each key with a budget well below the data size */
+static void bench_extsort(size_t n) {
+    const char *in = "bench_extsort_in.csv", *out = "bench_extsort_out.csv";
+    FILE *f = fopen(in, "w");
+    if (!f) { perror(in); return; }
+    fprintf(f, CSV_HEADER "\n");
+    for (size_t i = 0; i < n; ++i) {
+        Track t;
+        synth_track(&t, i);
+        write_csv_row(f, &t);
+        free_track(&t);
+    }
+    long bytes = ftell(f);
+    fclose(f);
+    size_t budget = (size_t)bytes / 8 > (1u << 20) ? (size_t)bytes / 8 : (1u << 20);
+    FsyncPolicy saved = g_fsync_policy;
+    g_fsync_policy = FSYNC_NEVER;
+    printf("bench extsort: %zu rows, %.1f MB input, %.1f MB budget\n", n, (double)bytes / 1e6, (double)budget / 1e6);
+    static const char *const names[3] = {"title", "artist", "dur"};
+    for (int k = 0; k < 3; ++k) {
+        size_t nruns = 0;
+        double t0 = now_sec();
+        long rows = extsort_csv(in, out, (SortKind)k, budget, &nruns);
+        double dt = now_sec() - t0;
+        printf(" %-6s %8.3f s  %3zu runs  %8.1f MB/s  %9.0f rows/s%s\n", names[k], dt, nruns,
+               (double)bytes / dt / 1e6, (double)n / dt, rows == (long)n ? "" : "  (row count mismatch!)");
+    }
+    g_fsync_policy = saved;
+    remove(in); remove(out);
+}
+
+/* Set operations over playlist files, streaming: only track key hashes are
+   kept in memory (8 bytes per distinct track), rows are copied straight from
+   the inputs to the output. Results have set semantics: each track once, in
+   first-seen order.
+     union      tracks in any input
+     intersect  tracks of the first input that appear in every other
+     diff       tracks of the first input that appear in none of the others */
+typedef enum { SETOP_UNION, SETOP_INTERSECT, SETOP_DIFF } SetOp;
+
+/* Adds the keys of path to dst, keeping only those in filter if given */
+static int hash_playlist_file(const char *path, HashSet64 *dst, const HashSet64 *filter) {
+    FILE *f = open_csv_rows(path);
+    if (!f) return 0;
+    char *line = NULL;
+    size_t cap = 0;
+    Track t;
+    while (next_csv_track(f, &line, &cap, &t)) {
+        unsigned long long h = track_key_hash(&t);
+        if (!filter || hs_contains(filter, h)) hs_insert(dst, h);
+        free_track(&t);
+    }
+    fclose(f);
+    return 1;
+}
+/* Returns rows written, or -1 if an input or the output could not be opened */
+static long setop_files(SetOp op, const char *out, char **in, size_t nin) {
+    HashSet64 other = {0}, emitted = {0};
+    int ok = 1;
+    size_t streamed = op == SETOP_UNION ? nin : 1;
+    for (size_t i = 0; i < streamed; ++i)
+        if (csv_has_meta(in[i])) return -1;
+    if (op == SETOP_INTERSECT) {
+        /* narrow from the last input back to the second */
+        ok = hash_playlist_file(in[nin - 1], &other, NULL);
+        for (size_t i = nin - 1; ok && i-- > 1;) {
+            HashSet64 narrowed = {0};
+            ok = hash_playlist_file(in[i], &narrowed, &other);
+            hs_free(&other);
+            other = narrowed;
+        }
+    } else if (op == SETOP_DIFF) {
+        for (size_t i = 1; ok && i < nin; ++i) ok = hash_playlist_file(in[i], &other, NULL);
+    }
+    char tmp[MAX_LINE + 32];
+    FILE *o = ok ? atomic_begin(out, tmp) : NULL;
+    if (!o) { hs_free(&other); return -1; }
+    fprintf(o, CSV_HEADER "\n");
+    long rows = 0;
+    for (size_t i = 0; ok && i < streamed; ++i) {
+        FILE *f = open_csv_rows(in[i]);
+        if (!f) { ok = 0; break; }
+        char *line = NULL;
+        size_t cap = 0;
+        Track t;
+        while (next_csv_track(f, &line, &cap, &t)) {
+            unsigned long long h = track_key_hash(&t);
+            int keep = op == SETOP_UNION || (op == SETOP_INTERSECT) == hs_contains(&other, h);
+            if (keep && hs_insert(&emitted, h)) { write_csv_row(o, &t); rows++; }
+            free_track(&t);
+        }
+        fclose(f);
+    }
+    hs_free(&other); hs_free(&emitted);
+    return atomic_finish(o, tmp, out, ok) ? rows : -1;
+}
+
+/* Order-aware compare of two playlist versions. Tracks are matched by key
+   hash with patience diff: common prefix/suffix are matched, then tracks that
+   occur exactly once on both sides are matched along a longest increasing
+   subsequence, and the gaps between those anchors are diffed recursively
+   (small anchorless gaps fall back to an LCS table). A removed track that is
+   added elsewhere is reported as a move. */
+typedef struct {
+    size_t *a, *b; /* matched positions, increasing in both */
+    size_t n, cap;
+} DiffMatches;
+static void diff_match(DiffMatches *m, size_t a, size_t b) {
+    if (m->n == m->cap) {
+        m->cap = m->cap ? m->cap * 2 : 1024;
+        m->a = realloc(m->a, m->cap * sizeof(size_t));
+        m->b = realloc(m->b, m->cap * sizeof(size_t));
+        if (!m->a || !m->b) { perror("realloc"); exit(1); }
+    }
+    m->a[m->n] = a; m->b[m->n] = b; m->n++;
+}
+#define DIFF_LCS_MAX_CELLS (1u << 22)
+static void diff_lcs(const unsigned long long *A, size_t alo, size_t ahi,
+                     const unsigned long long *B, size_t blo, size_t bhi, DiffMatches *m) {
+    size_t na = ahi - alo, nb = bhi - blo;
+    unsigned int *len = calloc((na + 1) * (nb + 1), sizeof(unsigned int));
+    if (!len) { perror("calloc"); exit(1); }
+    for (size_t i = na; i-- > 0;)
+        for (size_t j = nb; j-- > 0;)
+            len[i * (nb + 1) + j] = A[alo + i] == B[blo + j] ? len[(i + 1) * (nb + 1) + j + 1] + 1
+                : (len[(i + 1) * (nb + 1) + j] > len[i * (nb + 1) + j + 1] ? len[(i + 1) * (nb + 1) + j] : len[i * (nb + 1) + j + 1]);
+    for (size_t i = 0, j = 0; i < na && j < nb;) {
+        if (A[alo + i] == B[blo + j]) { diff_match(m, alo + i, blo + j); i++; j++; }
+        else if (len[(i + 1) * (nb + 1) + j] >= len[i * (nb + 1) + j + 1]) i++;
+        else j++;
+    }
+    free(len);
+}
+static void patience_diff(const unsigned long long *A, size_t alo, size_t ahi,
+                          const unsigned long long *B, size_t blo, size_t bhi, DiffMatches *m) {
+    while (alo < ahi && blo < bhi && A[alo] == B[blo]) diff_match(m, alo++, blo++);
+    size_t sa = ahi, sb = bhi;
+    while (sa > alo && sb > blo && A[sa - 1] == B[sb - 1]) { sa--; sb--; }
+    if (alo < sa && blo < sb) {
+        /* value: occurrences in A (low 16 bits), in B (next 16), last B position */
+        HashMap64 occ = {0};
+        for (size_t i = alo; i < sa; ++i) { long long *v = hm_slot(&occ, A[i], 1); if ((*v & 0xFFFF) < 2) (*v)++; }
+        for (size_t j = blo; j < sb; ++j) {
+            long long *v = hm_slot(&occ, B[j], 0);
+            if (v && ((*v >> 16) & 0xFFFF) < 2) *v = (*v & 0xFFFF) | (((*v >> 16) & 0xFFFF) + 1) << 16 | (long long)j << 32;
+        }
+        /* unique-in-both candidates in A order; LIS over their B positions */
+        size_t *ca = NULL, *cb = NULL, nc = 0;
+        for (size_t i = alo; i < sa; ++i) {
+            long long v = hm_get(&occ, A[i]);
+            if ((v & 0xFFFFFFFF) == (1 | 1 << 16)) {
+                if ((nc & (nc - 1)) == 0) {
+                    ca = realloc(ca, (nc ? nc * 2 : 1) * sizeof(size_t));
+                    cb = realloc(cb, (nc ? nc * 2 : 1) * sizeof(size_t));
+                    if (!ca || !cb) { perror("realloc"); exit(1); }
+                }
+                ca[nc] = i; cb[nc] = (size_t)(v >> 32); nc++;
+            }
+        }
+        hm_free(&occ);
+        if (nc) {
+            size_t *tails = malloc(nc * sizeof(size_t)), *prev = malloc(nc * sizeof(size_t)), ntails = 0;
+            if (!tails || !prev) { perror("malloc"); exit(1); }
+            for (size_t k = 0; k < nc; ++k) {
+                size_t lo = 0, hi = ntails;
+                while (lo < hi) { size_t mid = (lo + hi) / 2; if (cb[tails[mid]] < cb[k]) lo = mid + 1; else hi = mid; }
+                prev[k] = lo ? tails[lo - 1] : (size_t)-1;
+                tails[lo] = k;
+                if (lo == ntails) ntails++;
+            }
+            size_t *anchors = malloc(ntails * sizeof(size_t));
+            if (!anchors) { perror("malloc"); exit(1); }
+            for (size_t k = tails[ntails - 1], r = ntails; r-- > 0; k = prev[k]) anchors[r] = k;
+            size_t pa = alo, pb = blo;
+            for (size_t r = 0; r < ntails; ++r) {
+                patience_diff(A, pa, ca[anchors[r]], B, pb, cb[anchors[r]], m);
+                diff_match(m, ca[anchors[r]], cb[anchors[r]]);
+                pa = ca[anchors[r]] + 1; pb = cb[anchors[r]] + 1;
+            }
+            patience_diff(A, pa, sa, B, pb, sb, m);
+            free(tails); free(prev); free(anchors);
+        } else if ((sa - alo) * (sb - blo) <= DIFF_LCS_MAX_CELLS) {
+            diff_lcs(A, alo, sa, B, blo, sb, m);
+        }
+        free(ca); free(cb);
+    }
+    for (; sa < ahi; ++sa, ++sb) diff_match(m, sa, sb);
+}
+
+static unsigned long long *playlist_key_hashes(const Playlist *pl) {
+    unsigned long long *h = malloc((pl->size ? pl->size : 1) * sizeof(unsigned long long));
+    if (!h) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < pl->size; ++i) h[i] = track_key_hash(&pl->items[i]);
+    return h;
+}
+static void print_diff_line(char mark, const Track *t, size_t from, size_t to) {
+    if (mark == '~') printf("~ %zu -> %zu) %s — %s\n", from + 1, to + 1, t->title, t->artist);
+    else printf("%c %zu) %s — %s\n", mark, (mark == '-' ? from : to) + 1, t->title, t->artist);
+}
+/* Prints the edit script from a to b unless summary_only */
+static void compare_playlists(const Playlist *a, const Playlist *b, int summary_only) {
+    unsigned long long *A = playlist_key_hashes(a), *B = playlist_key_hashes(b);
+    DiffMatches m = {0};
+    patience_diff(A, 0, a->size, B, 0, b->size, &m);
+    /* removed positions chained per key, so an add of the same key is a move */
+    unsigned char *moved = calloc(a->size + 1, 1);
+    size_t *next = malloc((a->size + 1) * sizeof(size_t));
+    HashMap64 removed = {0};
+    if (!moved || !next) { perror("malloc"); exit(1); }
+    for (size_t k = 0, i = 0; k <= m.n; ++k) {
+        size_t end = k < m.n ? m.a[k] : a->size;
+        for (; i < end; ++i) {
+            long long *head = hm_slot(&removed, A[i], 1);
+            next[i] = (size_t)*head; /* stored +1, 0 = none */
+            *head = (long long)i + 1;
+        }
+        i = end + 1;
+    }
+    for (size_t j = 0, k = 0; k <= m.n; ++k) {
+        size_t j_end = k < m.n ? m.b[k] : b->size;
+        for (; j < j_end; ++j) {
+            long long *head = hm_slot(&removed, B[j], 0);
+            if (head && *head) {
+                size_t from = (size_t)*head - 1;
+                *head = (long long)next[from];
+                moved[from] = 1;
+                next[from] = j; /* remember destination */
+            }
+        }
+        j = j_end + 1;
+    }
+    size_t added = 0, dropped = 0, moves = 0;
+    for (size_t k = 0, i = 0; k <= m.n; ++k) {
+        size_t i_end = k < m.n ? m.a[k] : a->size;
+        for (; i < i_end; ++i) {
+            if (moved[i]) { moves++; if (!summary_only) print_diff_line('~', &a->items[i], i, next[i]); }
+            else { dropped++; if (!summary_only) print_diff_line('-', &a->items[i], i, 0); }
+        }
+        i = i_end + 1;
+    }
+    /* additions are the B positions neither matched nor a move target */
+    unsigned char *is_target = calloc(b->size + 1, 1);
+    if (!is_target) { perror("calloc"); exit(1); }
+    for (size_t i = 0; i < a->size; ++i) if (moved[i]) is_target[next[i]] = 1;
+    for (size_t k = 0; k < m.n; ++k) is_target[m.b[k]] = 1;
+    for (size_t j = 0; j < b->size; ++j) {
+        if (is_target[j]) continue;
+        added++;
+        if (!summary_only) print_diff_line('+', &b->items[j], 0, j);
+    }
+    printf("%zu unchanged, %zu added, %zu removed, %zu moved\n", m.n, added, dropped, moves);
+    free(is_target); free(moved); free(next); hm_free(&removed);
+    free(m.a); free(m.b); free(A); free(B);
+}
+
+/* Three-way merge of playlist versions by track key. Membership changes
+   from both sides are combined: a track theirs removed (relative to base)
+   is dropped from ours, a track theirs added is inserted after the nearest
+   track that precedes it in theirs and survives in the result. The order
+   otherwise follows ours. If a track's duration changed on only one side,
+   that change wins; if both changed it differently, ours is kept and the
+   track is counted as a conflict. Only the base fields are merged, so
+   versions carrying metadata are refused. */
+static long merge_playlists(const Playlist *base, const Playlist *ours, const Playlist *theirs,
+                            const char *out, size_t *added, size_t *dropped, size_t *conflicts) {
+    if (base->meta.rows || ours->meta.rows || theirs->meta.rows) {
+        fprintf(stderr, "%s: inputs have metadata columns that merge would drop\n", out);
+        return -1;
+    }
+    HashMap64 cnt_base = {0}, cnt_ours = {0}, cnt_theirs = {0}, dur_base = {0}, dur_theirs = {0};
+    HashMap64 drop_left = {0}, add_left = {0}, pos = {0};
+    unsigned long long *HB = playlist_key_hashes(base), *HO = playlist_key_hashes(ours), *HT = playlist_key_hashes(theirs);
+    for (size_t i = 0; i < base->size; ++i)
+        if ((*hm_slot(&cnt_base, HB[i], 1))++ == 0) *hm_slot(&dur_base, HB[i], 1) = base->items[i].duration;
+    for (size_t i = 0; i < ours->size; ++i) (*hm_slot(&cnt_ours, HO[i], 1))++;
+    for (size_t i = 0; i < theirs->size; ++i)
+        if ((*hm_slot(&cnt_theirs, HT[i], 1))++ == 0) *hm_slot(&dur_theirs, HT[i], 1) = theirs->items[i].duration;
+    for (size_t i = 0; i < base->size; ++i)
+        *hm_slot(&drop_left, HB[i], 1) = hm_get(&cnt_base, HB[i]) - hm_get(&cnt_theirs, HB[i]);
+
+    /* kept: ours minus theirs' removals; pos maps key -> kept index + 1 */
+    size_t nmax = ours->size + theirs->size + 1, nkept = 0, nadd = 0;
+    Track *kept = malloc(nmax * sizeof(Track));
+    const Track **adds = malloc(nmax * sizeof(Track *));
+    size_t *add_slot = malloc(nmax * sizeof(size_t)), *slot_start = calloc(ours->size + 2, sizeof(size_t));
+    if (!kept || !adds || !add_slot || !slot_start) { perror("malloc"); exit(1); }
+    *added = *dropped = *conflicts = 0;
+    for (size_t i = 0; i < ours->size; ++i) {
+        long long *d = hm_slot(&drop_left, HO[i], 0);
+        if (d && *d > 0) { (*d)--; (*dropped)++; continue; }
+        kept[nkept] = ours->items[i];
+        if (hm_slot(&dur_base, HO[i], 0) && hm_slot(&dur_theirs, HO[i], 0)) {
+            int db = (int)hm_get(&dur_base, HO[i]), dt = (int)hm_get(&dur_theirs, HO[i]);
+            if (kept[nkept].duration == db) kept[nkept].duration = dt;
+            else if (dt != db && dt != kept[nkept].duration) (*conflicts)++;
+        }
+        long long *p = hm_slot(&pos, HO[i], 1);
+        if (!*p) *p = (long long)nkept + 1;
+        nkept++;
+    }
+    /* theirs' additions: each goes after the last surviving track seen
+       before it in theirs (slot = kept index + 1, 0 = front) */
+    size_t anchor = 0;
+    for (size_t j = 0; j < theirs->size; ++j) {
+        long long *left = hm_slot(&add_left, HT[j], 1); /* adds to place + 1; 0 = unset */
+        if (*left == 0) {
+            long long cb = hm_get(&cnt_base, HT[j]), co = hm_get(&cnt_ours, HT[j]);
+            long long n = hm_get(&cnt_theirs, HT[j]) - cb - (co > cb ? co - cb : 0);
+            *left = (n > 0 ? n : 0) + 1;
+        }
+        if (*left > 1) {
+            (*left)--;
+            adds[nadd] = &theirs->items[j];
+            add_slot[nadd++] = anchor;
+            slot_start[anchor + 1]++;
+            continue;
+        }
+        long long p = hm_get(&pos, HT[j]);
+        if (p) anchor = (size_t)p;
+    }
+    *added = nadd;
+    /* group additions by slot, keeping theirs order within a slot */
+    for (size_t k = 1; k <= nkept + 1; ++k) slot_start[k] += slot_start[k - 1];
+    const Track **by_slot = malloc((nadd + 1) * sizeof(Track *));
+    size_t *fill = malloc((nkept + 1) * sizeof(size_t));
+    if (!by_slot || !fill) { perror("malloc"); exit(1); }
+    memcpy(fill, slot_start, (nkept + 1) * sizeof(size_t));
+    for (size_t k = 0; k < nadd; ++k) by_slot[fill[add_slot[k]]++] = adds[k];
+
+    char tmp[MAX_LINE + 32];
+    FILE *o = atomic_begin(out, tmp);
+    long rows = -1;
+    if (o) {
+        fprintf(o, CSV_HEADER "\n");
+        for (size_t slot = 0; slot <= nkept; ++slot) {
+            if (slot) write_csv_row(o, &kept[slot - 1]);
+            for (size_t k = slot_start[slot]; k < slot_start[slot + 1]; ++k) write_csv_row(o, by_slot[k]);
+        }
+        rows = atomic_finish(o, tmp, out, 1) ? (long)(nkept + nadd) : -1;
+    }
+    free(kept); free(adds); free(add_slot); free(slot_start); free(by_slot); free(fill);
+    free(HB); free(HO); free(HT);
+    hm_free(&cnt_base); hm_free(&cnt_ours); hm_free(&cnt_theirs); hm_free(&dur_base); hm_free(&dur_theirs);
+    hm_free(&drop_left); hm_free(&add_left); hm_free(&pos);
+    return rows;
+}
+
+/* File watch: when another tool rewrites the watched file, only the rows that
+   changed are applied. The watcher remembers the multiset of row hashes
+   (raw line bytes) of the last version it saw, with each row's track key;
+   on change, rows whose count went up are parsed and added and rows whose
+   count went down remove one track with that key each. Unchanged rows are
+   neither parsed nor touched. The directory is watched so replace-by-rename
+   saves are seen; events are drained before each command (Linux only). */
+typedef struct {
+    int fd, wd;
+    char path[MAX_LINE];
+    const char *name;   /* basename of path, matched against events */
+    HashMap64 rows;     /* row hash -> occurrences */
+    HashMap64 row_key;  /* row hash -> track key hash */
+} FileWatch;
+
+static unsigned long long hash_bytes(const char *s) {
+    unsigned long long h = 0xCBF29CE484222325ull;
+    for (; *s; ++s) h = (h ^ (unsigned char)*s) * 0x100000001B3ull;
+    h = hash_mix(h);
+    return h ? h : 1;
+}
+/* Removes one track per unit of count in keys (key hash -> count) */
+static size_t remove_tracks_by_key(Playlist *pl, HashMap64 *keys) {
+    size_t out = 0, removed = 0;
+    for (size_t i = 0; i < pl->size; ++i) {
+        long long *c = hm_slot(keys, track_key_hash(&pl->items[i]), 0);
+        if (c && *c > 0) { (*c)--; drop_track(pl, &pl->items[i]); removed++; continue; }
+        pl->items[out++] = pl->items[i];
+    }
+    pl->size = out;
+    return removed;
+}
+/* Hashes the file's rows into w; with pl, applies the changes vs the old
+   multiset to pl. Returns 0 if the file cannot be read. */
+static int watch_sync(FileWatch *w, Playlist *pl, size_t *added, size_t *removed) {
+    FILE *f = open_csv_rows(w->path);
+    if (!f) return 0;
+    HashMap64 rows = {0}, row_key = {0};
+    char *line = NULL;
+    size_t cap = 0;
+    *added = *removed = 0;
+    while (read_line(f, &line, &cap)) {
+        unsigned long long h = hash_bytes(line);
+        long long *n = hm_slot(&rows, h, 1);
+        (*n)++;
+        long long *k = hm_slot(&row_key, h, 1);
+        if (*n > 1) continue;
+        Track t;
+        char *copy = strdup_safe(line);
+        int ok = parse_csv_track(copy, &t);
+        free(copy);
+        if (!ok) { *k = 0; continue; }
+        *k = (long long)track_key_hash(&t);
+        free_track(&t);
+    }
+    if (pl) {
+        /* second pass adds rows beyond their old count, in file order */
+        rewind(f);
+        HashMap64 seen = {0};
+        if (read_line(f, &line, &cap) && (strstr(line, "title") == NULL || strstr(line, "artist") == NULL)) rewind(f);
+        while (read_line(f, &line, &cap)) {
+            unsigned long long h = hash_bytes(line);
+            long long *n = hm_slot(&seen, h, 1);
+            if (++*n > hm_get(&w->rows, h)) *added += (size_t)parse_csv_line(pl, line);
+        }
+        hm_free(&seen);
+        HashMap64 gone = {0};
+        for (size_t i = 0; i < w->rows.cap; ++i) {
+            unsigned long long h = w->rows.keys[i];
+            if (!h) continue;
+            long long lost = w->rows.vals[i] - hm_get(&rows, h), key = hm_get(&w->row_key, h);
+            if (lost > 0 && key) *hm_slot(&gone, (unsigned long long)key, 1) += lost;
+        }
+        if (gone.size) *removed = remove_tracks_by_key(pl, &gone);
+        hm_free(&gone);
+    }
+    free(line);
+    fclose(f);
+    hm_free(&w->rows); hm_free(&w->row_key);
+    w->rows = rows; w->row_key = row_key;
+    return 1;
+}
+static void watch_stop(FileWatch *w) {
+    if (w->fd >= 0) close(w->fd);
+    w->fd = w->wd = -1;
+    hm_free(&w->rows); hm_free(&w->row_key);
+}
+static int watch_start(FileWatch *w, const char *path) {
+#ifdef __linux__
+    watch_stop(w);
+    snprintf(w->path, sizeof(w->path), "%s", path);
+    const char *slash = strrchr(w->path, '/');
+    char dir[MAX_LINE];
+    if (slash) snprintf(dir, sizeof(dir), "%.*s", (int)(slash - w->path), w->path);
+    else snprintf(dir, sizeof(dir), ".");
+    w->name = slash ? slash + 1 : w->path;
+    w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w->fd < 0) return 0;
+    w->wd = inotify_add_watch(w->fd, dir[0] ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO);
+    size_t a, r;
+    if (w->wd < 0 || !watch_sync(w, NULL, &a, &r)) { watch_stop(w); return 0; }
+    return 1;
+#else
+    (void)w; (void)path;
+    return 0;
+#endif
+}
+/* Drains pending events; reloads once if the watched file changed */
+static void watch_poll(FileWatch *w, Playlist *pl) {
+#ifdef __linux__
+    if (w->fd < 0) return;
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int changed = 0;
+    ssize_t n;
+    while ((n = read(w->fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n;) {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+            if (ev->len && strcmp(ev->name, w->name) == 0) changed = 1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    size_t added, removed;
+    if (changed && watch_sync(w, pl, &added, &removed) && (added || removed))
+        printf("[%s changed: +%zu -%zu tracks]\n", w->path, added, removed);
+#else
+    (void)w; (void)pl;
+#endif
+}
+
+/* Paged storage: tracks live in fixed-size pages of a temp file and are only
+   accessed through a buffer pool of `nframes` frames with CLOCK eviction, so
+   memory stays at the pool size plus a small per-page directory (record
+   count, resident frame and a Fenwick tree over counts to map a playlist
+   index to its page). A record is u16 len, "title\0artist\0album\0", i32
+   duration; removing one compacts its page in place. */
+typedef struct {
+    long page;           /* -1 if free */
+    unsigned char ref, dirty;
+} Frame;
+typedef struct {
+    FILE *file;
+    size_t npages, total;
+    unsigned short *counts;  /* records per page */
+    int *frame_of;           /* resident frame per page, -1 if none */
+    unsigned int *fenwick;   /* prefix sums of counts, 1-based */
+    unsigned char *pool;     /* nframes * PAGED_PAGE_SIZE */
+    Frame *frames;
+    size_t nframes, hand;
+    unsigned long long hits, misses, evictions, writebacks;
+} PagedStore;
+
+static void paged_fenwick_add(PagedStore *ps, size_t page, int delta) {
+    for (size_t i = page + 1; i <= ps->npages; i += i & (~i + 1)) ps->fenwick[i] += (unsigned int)delta;
+}
+/* Page holding playlist index idx; *rank is idx's position within it */
+static size_t paged_find(const PagedStore *ps, size_t idx, size_t *rank) {
+    size_t pos = 0, step = 1;
+    while (step * 2 <= ps->npages) step *= 2;
+    for (; step; step /= 2) {
+        if (pos + step <= ps->npages && ps->fenwick[pos + step] <= idx) {
+            pos += step;
+            idx -= ps->fenwick[pos];
+        }
+    }
+    *rank = idx;
+    return pos;
+}
+static void paged_write_frame(PagedStore *ps, size_t f) {
+    fseeko(ps->file, (off_t)ps->frames[f].page * PAGED_PAGE_SIZE, SEEK_SET);
+    if (fwrite(ps->pool + f * PAGED_PAGE_SIZE, 1, PAGED_PAGE_SIZE, ps->file) != PAGED_PAGE_SIZE) { perror("paged write"); exit(1); }
+    ps->frames[f].dirty = 0;
+    ps->writebacks++;
+}
+/* Returns the page's bytes, reading it in (and evicting) on a miss */
+static unsigned char *paged_fetch(PagedStore *ps, size_t page) {
+    int fi = ps->frame_of[page];
+    if (fi >= 0) {
+        ps->hits++;
+        ps->frames[fi].ref = 1;
+        return ps->pool + (size_t)fi * PAGED_PAGE_SIZE;
+    }
+    ps->misses++;
+    for (;;) {
+        Frame *fr = &ps->frames[ps->hand];
+        if (fr->page >= 0 && fr->ref) { fr->ref = 0; ps->hand = (ps->hand + 1) % ps->nframes; continue; }
+        break;
+    }
+    size_t f = ps->hand;
+    ps->hand = (ps->hand + 1) % ps->nframes;
+    Frame *fr = &ps->frames[f];
+    if (fr->page >= 0) {
+        if (fr->dirty) paged_write_frame(ps, f);
+        ps->frame_of[fr->page] = -1;
+        ps->evictions++;
+    }
+    fseeko(ps->file, (off_t)page * PAGED_PAGE_SIZE, SEEK_SET);
+    if (fread(ps->pool + f * PAGED_PAGE_SIZE, 1, PAGED_PAGE_SIZE, ps->file) != PAGED_PAGE_SIZE) { perror("paged read"); exit(1); }
+    fr->page = (long)page;
+    fr->ref = 1;
+    fr->dirty = 0;
+    ps->frame_of[page] = (int)f;
+    return ps->pool + f * PAGED_PAGE_SIZE;
+}
+static void paged_mark_dirty(PagedStore *ps, size_t page) {
+    ps->frames[ps->frame_of[page]].dirty = 1;
+}
+/* Decodes the record at p; t borrows the page's bytes */
+static const unsigned char *paged_decode(const unsigned char *p, Track *t) {
+    size_t len = get_u16(p);
+    const char *s = (const char *)p + 2;
+    t->title = (char *)s; s += strlen(s) + 1;
+    t->artist = (char *)s; s += strlen(s) + 1;
+    t->album = (char *)s;
+    t->duration = (int)get_u32(p + 2 + len - 4);
+    t->id = 0;
+    return p + 2 + len;
+}
+
+static void paged_close(PagedStore *ps) {
+    if (ps->file) fclose(ps->file);
+    free(ps->counts); free(ps->frame_of); free(ps->fenwick); free(ps->pool); free(ps->frames);
+    memset(ps, 0, sizeof(*ps));
+}
+/* Streams a playlist file (CSV) into pages; only one page is buffered. The
+   pages live in a scratch file in dir (NULL: see scratch_file). */
+static int paged_open(PagedStore *ps, const char *path, size_t pool_bytes, const char *dir) {
+    if (csv_has_meta(path)) return 0;
+    FILE *in = open_csv_rows(path);
+    if (!in) return 0;
+    memset(ps, 0, sizeof(*ps));
+    ps->file = scratch_file(dir, path);
+    if (!ps->file) { fclose(in); return 0; }
+    unsigned char page[PAGED_PAGE_SIZE];
+    size_t used = 0, count = 0, cap = 0, lcap = 0;
+    char *line = NULL;
+    Track t;
+    for (int more = 1; more;) {
+        more = next_csv_track(in, &line, &lcap, &t);
+        size_t lt = 0, la = 0, lb = 0, len = 0;
+        if (more) {
+            lt = strlen(t.title); la = strlen(t.artist); lb = strlen(t.album);
+            len = lt + la + lb + 3 + 4;
+        }
+        if (count && (!more || PAGED_PAGE_HDR + used + 2 + len > PAGED_PAGE_SIZE)) {
+            put_u16(page, (unsigned int)count);
+            put_u16(page + 2, (unsigned int)used);
+            memset(page + PAGED_PAGE_HDR + used, 0, PAGED_PAGE_SIZE - PAGED_PAGE_HDR - used);
+            if (fwrite(page, 1, PAGED_PAGE_SIZE, ps->file) != PAGED_PAGE_SIZE) { perror("paged write"); exit(1); }
+            if (ps->npages == cap) {
+                cap = cap ? cap * 2 : 256;
+                ps->counts = realloc(ps->counts, cap * sizeof(unsigned short));
+                if (!ps->counts) { perror("realloc"); exit(1); }
+            }
+            ps->counts[ps->npages++] = (unsigned short)count;
+            ps->total += count;
+            used = count = 0;
+        }
+        if (!more) break;
+        unsigned char *r = page + PAGED_PAGE_HDR + used;
+        put_u16(r, (unsigned int)len);
+        memcpy(r + 2, t.title, lt + 1);
+        memcpy(r + 2 + lt + 1, t.artist, la + 1);
+        memcpy(r + 2 + lt + la + 2, t.album, lb + 1);
+        put_u32(r + 2 + len - 4, (unsigned int)t.duration);
+        used += 2 + len;
+        count++;
+        free_track(&t);
+    }
+    fclose(in);
+    ps->frame_of = malloc((ps->npages + 1) * sizeof(int));
+    ps->fenwick = calloc(ps->npages + 1, sizeof(unsigned int));
+    ps->nframes = pool_bytes / PAGED_PAGE_SIZE < 2 ? 2 : pool_bytes / PAGED_PAGE_SIZE;
+    ps->pool = malloc(ps->nframes * PAGED_PAGE_SIZE);
+    ps->frames = malloc(ps->nframes * sizeof(Frame));
+    if (!ps->frame_of || !ps->fenwick || !ps->pool || !ps->frames) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < ps->npages; ++i) { ps->frame_of[i] = -1; paged_fenwick_add(ps, i, ps->counts[i]); }
+    for (size_t f = 0; f < ps->nframes; ++f) { ps->frames[f].page = -1; ps->frames[f].ref = ps->frames[f].dirty = 0; }
+    return 1;
+}
+
+/* Calls fn for each track in order; stops early if fn returns 0 */
+static void paged_each(PagedStore *ps, int (*fn)(const Track *, size_t, void *), void *ctx) {
+    size_t idx = 0;
+    for (size_t pg = 0; pg < ps->npages; ++pg) {
+        if (!ps->counts[pg]) continue;
+        const unsigned char *p = paged_fetch(ps, pg) + PAGED_PAGE_HDR;
+        for (size_t k = 0; k < ps->counts[pg]; ++k) {
+            Track t;
+            p = paged_decode(p, &t);
+            if (!fn(&t, idx++, ctx)) return;
+        }
+    }
+}
+static int paged_print_cb(const Track *t, size_t idx, void *ctx) {
+    (void)ctx;
+    print_track(t, idx);
+    return 1;
+}
+static int paged_search_cb(const Track *t, size_t idx, void *ctx) {
+    void **c = ctx;
+    if (track_matches(t, c[0])) { print_track(t, idx); *(int *)c[1] = 1; }
+    return 1;
+}
+static int paged_save_cb(const Track *t, size_t idx, void *ctx) {
+    (void)idx;
+    write_csv_row(ctx, t);
+    return 1;
+}
+/* Borrowed view of track idx, valid until the next pool access */
+static int paged_get(PagedStore *ps, size_t idx, Track *t) {
+    if (idx >= ps->total) return 0;
+    size_t rank, pg = paged_find(ps, idx, &rank);
+    const unsigned char *p = paged_fetch(ps, pg) + PAGED_PAGE_HDR;
+    while (rank--) p += 2 + get_u16(p);
+    paged_decode(p, t);
+    return 1;
+}
+static int paged_remove(PagedStore *ps, size_t idx) {
+    if (idx >= ps->total) return 0;
+    size_t rank, pg = paged_find(ps, idx, &rank);
+    unsigned char *page = paged_fetch(ps, pg);
+    unsigned char *p = page + PAGED_PAGE_HDR;
+    while (rank--) p += 2 + get_u16(p);
+    size_t len = 2 + get_u16(p), used = get_u16(page + 2);
+    memmove(p, p + len, (size_t)(page + PAGED_PAGE_HDR + used - (p + len)));
+    put_u16(page, ps->counts[pg] - 1u);
+    put_u16(page + 2, (unsigned int)(used - len));
+    ps->counts[pg]--;
+    ps->total--;
+    paged_fenwick_add(ps, pg, -1);
+    paged_mark_dirty(ps, pg);
+    return 1;
+}
+static void paged_stats(const PagedStore *ps) {
+    unsigned long long acc = ps->hits + ps->misses;
+    size_t resident = 0;
+    for (size_t f = 0; f < ps->nframes; ++f) resident += ps->frames[f].page >= 0;
+    printf("paged: %zu tracks in %zu pages (%.1f MB on disk)\n", ps->total, ps->npages, (double)ps->npages * PAGED_PAGE_SIZE / 1e6);
+    printf(" pool: %zu frames (%.1f MB), %zu resident\n", ps->nframes, (double)ps->nframes * PAGED_PAGE_SIZE / 1e6, resident);
+    printf(" hits %llu  misses %llu  hit rate %.1f%%  evictions %llu  writebacks %llu\n",
+           ps->hits, ps->misses, acc ? 100.0 * (double)ps->hits / (double)acc : 0.0, ps->evictions, ps->writebacks);
+}
+
+/* Shared-memory publishing. A published version is one segment
+   "/<name>.<gen>" holding a header, a fixed-size track table, a title-order
+   index and a string blob, all addressed by offsets from the segment start
+   so readers can map it anywhere. The small control segment "/<name>" holds
+   the current generation; publishing writes the new segment completely,
+   then swaps the generation atomically and unlinks the old name. Readers
+   that already mapped the old version keep it until they unmap. */
+typedef struct {
+    unsigned int magic, version;
+    unsigned long long generation;
+    unsigned long long count;
+    unsigned long long tracks_off;  /* ShmTrack[count] */
+    unsigned long long order_off;   /* unsigned int[count], tracks by title */
+    unsigned long long strings_off; /* NUL-terminated strings */
+    unsigned long long strings_len;
+    unsigned long long total_size;
+} ShmHeader;
+typedef struct {
+    unsigned long long title, artist, album; /* offsets into the string blob */
+    long long duration;
+} ShmTrack;
+typedef struct {
+    unsigned int magic;
+    _Atomic unsigned long long generation;
+} ShmControl;
+typedef struct {
+    void *base;
+    size_t len;
+    const ShmHeader *hdr;
+    const ShmTrack *tracks;
+    const unsigned int *order;
+    const char *strings;
+} ShmView;
+
+static void shm_segment_name(char *buf, size_t n, const char *name, unsigned long long gen) {
+    if (gen) snprintf(buf, n, "/%s.%llu", name, gen);
+    else snprintf(buf, n, "/%s", name);
+}
+static ShmControl *shm_control_map(const char *name, int create) {
+    char path[256];
+    shm_segment_name(path, sizeof(path), name, 0);
+    int fd = shm_open(path, create ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if (fd < 0) return NULL;
+    if (create && ftruncate(fd, sizeof(ShmControl)) != 0) { close(fd); return NULL; }
+    struct stat st; /* a short segment would fault on access */
+    if (!create && (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ShmControl))) { close(fd); return NULL; }
+    void *p = mmap(NULL, sizeof(ShmControl), create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return NULL;
+    ShmControl *c = p;
+    if (create && c->magic != SHM_MAGIC) c->magic = SHM_MAGIC; /* fresh segments are zeroed */
+    if (c->magic != SHM_MAGIC) { munmap(p, sizeof(ShmControl)); return NULL; }
+    return c;
+}
+
+static int publish_playlist_shm(const Playlist *pl, const char *name, unsigned long long *gen_out) {
+    if (pl->meta.rows) {
+        fprintf(stderr, "/%s: the shared segment holds only the base fields; metadata would be dropped\n", name);
+        return 0;
+    }
+    ShmControl *ctl = shm_control_map(name, 1);
+    if (!ctl) return 0;
+    unsigned long long old_gen = atomic_load(&ctl->generation), gen = old_gen + 1;
+    size_t n = pl->size, strings_len = 0;
+    for (size_t i = 0; i < n; ++i)
+        strings_len += strlen(pl->items[i].title) + strlen(pl->items[i].artist) + strlen(pl->items[i].album) + 3;
+    size_t tracks_off = (sizeof(ShmHeader) + 63) & ~(size_t)63;
+    size_t order_off = tracks_off + n * sizeof(ShmTrack);
+    size_t strings_off = order_off + n * sizeof(unsigned int);
+    size_t total = strings_off + strings_len + 1;
+    char path[256];
+    shm_segment_name(path, sizeof(path), name, gen);
+    int fd = shm_open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) { munmap(ctl, sizeof(ShmControl)); return 0; }
+    void *base = MAP_FAILED;
+    if (ftruncate(fd, (off_t)total) == 0)
+        base = mmap(NULL, total, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) { shm_unlink(path); munmap(ctl, sizeof(ShmControl)); return 0; }
+
+    ShmHeader *h = base;
+    ShmTrack *tracks = (ShmTrack *)((char *)base + tracks_off);
+    unsigned int *order = (unsigned int *)((char *)base + order_off);
+    char *strings = (char *)base + strings_off;
+    size_t off = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const Track *t = &pl->items[i];
+        const char *fields[3] = {t->title, t->artist, t->album};
+        unsigned long long *dst[3] = {&tracks[i].title, &tracks[i].artist, &tracks[i].album};
+        for (int f = 0; f < 3; ++f) {
+            size_t len = strlen(fields[f]) + 1;
+            memcpy(strings + off, fields[f], len);
+            *dst[f] = off;
+            off += len;
+        }
+        tracks[i].duration = t->duration;
+    }
+    strings[off] = '\0';
+    if (n) {
+        SortKey *keys = malloc(n * sizeof(SortKey));
+        if (!keys) { perror("malloc"); exit(1); }
+        gather_sort_keys(pl->items, n, SORT_TITLE, keys);
+        sort_keys(keys, n, SORT_TITLE);
+        for (size_t i = 0; i < n; ++i) order[i] = (unsigned int)(keys[i].t - pl->items);
+        free(keys);
+    }
+    h->version = SHM_VERSION;
+    h->generation = gen;
+    h->count = n;
+    h->tracks_off = tracks_off;
+    h->order_off = order_off;
+    h->strings_off = strings_off;
+    h->strings_len = strings_len + 1;
+    h->total_size = total;
+    atomic_thread_fence(memory_order_release);
+    h->magic = SHM_MAGIC;
+    munmap(base, total);
+
+    atomic_store(&ctl->generation, gen);
+    munmap(ctl, sizeof(ShmControl));
+    if (old_gen) {
+        shm_segment_name(path, sizeof(path), name, old_gen);
+        shm_unlink(path);
+    }
+    if (gen_out) *gen_out = gen;
+    return 1;
+}
+
+/* The segment may be corrupt or hostile: magic and version first, then
+   every region checked against the mapped size by subtraction and division
+   so no field can overflow a sum */
+static int shm_header_valid(const ShmHeader *h, size_t len) {
+    if (h->magic != SHM_MAGIC || h->version != SHM_VERSION || h->total_size != len) return 0;
+    if (h->strings_off > len || len - h->strings_off != h->strings_len || h->strings_len == 0) return 0;
+    if (h->order_off > h->strings_off || h->order_off % sizeof(unsigned int) ||
+        h->count > (h->strings_off - h->order_off) / sizeof(unsigned int)) return 0;
+    if (h->tracks_off < sizeof(ShmHeader) || h->tracks_off > h->order_off || h->tracks_off % sizeof(unsigned long long) ||
+        h->count > (h->order_off - h->tracks_off) / sizeof(ShmTrack)) return 0;
+    return ((const char *)h)[len - 1] == '\0'; /* shm_view_track clamps to it */
+}
+/* Map the current version read-only; retries if a publish races the open */
+static int shm_view_open(ShmView *v, const char *name) {
+    ShmControl *ctl = shm_control_map(name, 0);
+    if (!ctl) return 0;
+    int ok = 0;
+    for (int attempt = 0; attempt < 8 && !ok; ++attempt) {
+        char path[256];
+        shm_segment_name(path, sizeof(path), name, atomic_load(&ctl->generation));
+        int fd = shm_open(path, O_RDONLY, 0);
+        if (fd < 0) continue;
+        struct stat st;
+        if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(ShmHeader)) {
+            v->len = (size_t)st.st_size;
+            v->base = mmap(NULL, v->len, PROT_READ, MAP_SHARED, fd, 0);
+            if (v->base != MAP_FAILED) {
+                const ShmHeader *h = v->hdr = v->base;
+                if (shm_header_valid(h, v->len)) {
+                    v->tracks = (const ShmTrack *)((const char *)v->base + h->tracks_off);
+                    v->order = (const unsigned int *)((const char *)v->base + h->order_off);
+                    v->strings = (const char *)v->base + h->strings_off;
+                    ok = 1;
+                } else {
+                    munmap(v->base, v->len);
+                }
+            }
+        }
+        close(fd);
+    }
+    munmap(ctl, sizeof(ShmControl));
+    return ok;
+}
+static void shm_view_close(ShmView *v) {
+    if (v->base) munmap(v->base, v->len);
+    v->base = NULL;
+}
+/* Borrowed view of track i; strings point into the mapping */
+static Track shm_view_track(const ShmView *v, size_t i) {
+    const ShmTrack *st = &v->tracks[i];
+    size_t lim = v->hdr->strings_len - 1; /* offset of the final NUL */
+    Track t;
+    t.title = (char *)v->strings + (st->title < lim ? st->title : lim);
+    t.artist = (char *)v->strings + (st->artist < lim ? st->artist : lim);
+    t.album = (char *)v->strings + (st->album < lim ? st->album : lim);
+    t.duration = (int)st->duration;
+    t.id = 0;
+    return t;
+}
+/* Exact (case-insensitive) title lookup through the title-order index */
+static long shm_view_find_title(const ShmView *v, const char *title) {
+    size_t lo = 0, hi = v->hdr->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        unsigned int idx = v->order[mid];
+        if (idx >= v->hdr->count) return -1;
+        Track t = shm_view_track(v, idx);
+        if (strcasecmp(t.title, title) < 0) lo = mid + 1; else hi = mid;
+    }
+    if (lo < v->hdr->count && v->order[lo] < v->hdr->count) {
+        Track t = shm_view_track(v, v->order[lo]);
+        if (strcasecmp(t.title, title) == 0) return (long)v->order[lo];
+    }
+    return -1;
+}
+
+/* Play simulation: prints and sleeps briefly (duration limited for demo) */
+static void play_track(const Track *t) {
+    int demo_seconds = t->duration < 6 ? t->duration : 5; /* don't actually wait full song */
+    printf("Now playing: %s — %s [%d:%02d]  (demo %d sec)\n",
+           t->title, t->artist, t->duration/60, t->duration%60, demo_seconds);
+    fflush(stdout);
+    sleep(demo_seconds);
+}
+
+/* Play history: a play bumps the track's plays and last_played columns, goes
+   into a ring of the last RECENT_CAP plays and is appended to the history
+   file as a fixed-size record. The most-played tracks are kept in a TOP_CAP
+   min-heap updated on each play; counts only grow between plays, so the heap
+   stays exact, and it is rebuilt from the plays column only after counts
+   change some other way (load, remove, meta edits). */
+typedef struct {
+    unsigned int id;
+    long long when;
+} PlayEvent;
+typedef struct {
+    unsigned int plays, id;
+} TopEntry;
+typedef struct {
+    PlayEvent ring[RECENT_CAP];
+    size_t head, count;     /* next slot, entries held */
+    TopEntry top[TOP_CAP];  /* min-heap on plays */
+    size_t ntop;
+    HashMap64 top_pos;      /* id -> heap position + 1 */
+    unsigned long epoch;    /* meta.plays_epoch the heap reflects */
+    AppendLog log;
+} PlayHistory;
+
+static void top_swap(PlayHistory *h, size_t i, size_t j) {
+    TopEntry e = h->top[i]; h->top[i] = h->top[j]; h->top[j] = e;
+    *hm_slot(&h->top_pos, h->top[i].id, 1) = (long long)i + 1;
+    *hm_slot(&h->top_pos, h->top[j].id, 1) = (long long)j + 1;
+}
+static void top_down(PlayHistory *h, size_t i) {
+    for (;;) {
+        size_t l = 2 * i + 1, m = i;
+        if (l < h->ntop && h->top[l].plays < h->top[m].plays) m = l;
+        if (l + 1 < h->ntop && h->top[l + 1].plays < h->top[m].plays) m = l + 1;
+        if (m == i) return;
+        top_swap(h, i, m);
+        i = m;
+    }
+}
+/* Offers a track that is not in the heap */
+static void top_offer(PlayHistory *h, unsigned int id, unsigned int plays) {
+    if (h->ntop == TOP_CAP) {
+        if (plays <= h->top[0].plays) return;
+        hm_remove(&h->top_pos, h->top[0].id);
+        h->top[0].id = id; h->top[0].plays = plays;
+        *hm_slot(&h->top_pos, id, 1) = 1;
+        top_down(h, 0);
+        return;
+    }
+    size_t i = h->ntop++;
+    h->top[i].id = id; h->top[i].plays = plays;
+    *hm_slot(&h->top_pos, id, 1) = (long long)i + 1;
+    while (i && h->top[(i - 1) / 2].plays > h->top[i].plays) { top_swap(h, i, (i - 1) / 2); i = (i - 1) / 2; }
+}
+/* One pass over the plays column */
+static void top_rebuild(PlayHistory *h, const MetaColumns *m) {
+    h->ntop = 0;
+    hm_free(&h->top_pos);
+    for (size_t id = 1; id < m->rows; ++id)
+        if (m->plays[id]) top_offer(h, (unsigned int)id, m->plays[id]);
+    h->epoch = m->plays_epoch;
+}
+static void history_record(PlayHistory *h, Playlist *pl, const Track *t) {
+    MetaColumns *m = &pl->meta;
+    int fresh = h->epoch == m->plays_epoch;
+    long long now = (long long)time(NULL);
+    unsigned int plays = (unsigned int)meta_num(m, t->id, META_PLAYS);
+    if (plays < UINT_MAX) plays++;
+    meta_set_num(m, t->id, META_PLAYS, plays);
+    meta_set_num(m, t->id, META_LAST_PLAYED, now);
+    if (fresh) {
+        long long *pos = hm_slot(&h->top_pos, t->id, 0);
+        if (pos) { h->top[*pos - 1].plays = plays; top_down(h, (size_t)*pos - 1); }
+        else top_offer(h, t->id, plays);
+        h->epoch = m->plays_epoch;
+    }
+    h->ring[h->head].id = t->id;
+    h->ring[h->head].when = now;
+    h->head = (h->head + 1) % RECENT_CAP;
+    if (h->count < RECENT_CAP) h->count++;
+    if (h->log.f) {
+        unsigned char rec[HISTORY_REC_LEN];
+        put_u64(rec, track_key_hash(t));
+        put_u64(rec + 8, (unsigned long long)now);
+        fwrite(rec, 1, sizeof(rec), h->log.f);
+        log_appended(&h->log);
+    }
+}
+/* Opens the history file for appending and refills the ring from its last
+   RECENT_CAP records, matched to pl's tracks by key (others are skipped) */
+static int history_open(PlayHistory *h, const char *path, const Playlist *pl) {
+    memset(h, 0, sizeof(*h));
+    FILE *f = fopen(path, "rb");
+    if (f && fseek(f, 0, SEEK_END) == 0) {
+        long n = ftell(f) / HISTORY_REC_LEN; /* a torn final record is ignored */
+        long first = n > RECENT_CAP ? n - RECENT_CAP : 0;
+        HashMap64 ids = {0};
+        for (size_t i = 0; i < pl->size; ++i) *hm_slot(&ids, track_key_hash(&pl->items[i]), 1) = pl->items[i].id;
+        unsigned char rec[HISTORY_REC_LEN];
+        fseek(f, first * HISTORY_REC_LEN, SEEK_SET);
+        for (long i = first; i < n && fread(rec, 1, sizeof(rec), f) == sizeof(rec); ++i) {
+            long long id = hm_get(&ids, get_u64(rec));
+            if (!id) continue;
+            h->ring[h->head].id = (unsigned int)id;
+            h->ring[h->head].when = (long long)get_u64(rec + 8);
+            h->head = (h->head + 1) % RECENT_CAP;
+            if (h->count < RECENT_CAP) h->count++;
+        }
+        hm_free(&ids);
+    }
+    if (f) fclose(f);
+    h->epoch = pl->meta.plays_epoch - 1; /* build the heap on first use; the epoch only grows */
+    return log_open(&h->log, path);
+}
+static void history_close(PlayHistory *h) {
+    log_close(&h->log);
+    hm_free(&h->top_pos);
+}
+/* Fills want (id -> 0) with id -> playlist index + 1 in one pass */
+static void index_ids(const Playlist *pl, HashMap64 *want) {
+    for (size_t i = 0; i < pl->size; ++i) {
+        long long *v = hm_slot(want, pl->items[i].id, 0);
+        if (v) *v = (long long)i + 1;
+    }
+}
+static void print_recent(const PlayHistory *h, const Playlist *pl, size_t k) {
+    HashMap64 pos = {0};
+    if (k > h->count) k = h->count;
+    for (size_t i = 0; i < k; ++i) hm_slot(&pos, h->ring[(h->head + RECENT_CAP - 1 - i) % RECENT_CAP].id, 1);
+    index_ids(pl, &pos);
+    if (!k) puts("Nothing played yet.");
+    for (size_t i = 0; i < k; ++i) {
+        const PlayEvent *e = &h->ring[(h->head + RECENT_CAP - 1 - i) % RECENT_CAP];
+        char when[32];
+        time_t tt = (time_t)e->when;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime(&tt));
+        long long at = hm_get(&pos, e->id);
+        if (at) printf("[%s] ", when), print_track(&pl->items[at - 1], (size_t)at - 1);
+        else printf("[%s] (track no longer in playlist)\n", when);
+    }
+    hm_free(&pos);
+}
+static int cmp_top_desc(const void *a, const void *b) {
+    const TopEntry *x = a, *y = b;
+    if (x->plays != y->plays) return x->plays < y->plays ? 1 : -1;
+    return x->id < y->id ? -1 : x->id > y->id;
+}
+static void print_top(PlayHistory *h, const Playlist *pl, size_t k) {
+    if (h->epoch != pl->meta.plays_epoch) top_rebuild(h, &pl->meta);
+    TopEntry sorted[TOP_CAP];
+    memcpy(sorted, h->top, h->ntop * sizeof(TopEntry));
+    qsort(sorted, h->ntop, sizeof(TopEntry), cmp_top_desc);
+    if (k > h->ntop) k = h->ntop;
+    HashMap64 pos = {0};
+    for (size_t i = 0; i < k; ++i) hm_slot(&pos, sorted[i].id, 1);
+    index_ids(pl, &pos);
+    if (!k) puts("Nothing played yet.");
+    for (size_t i = 0; i < k; ++i) {
+        long long at = hm_get(&pos, sorted[i].id);
+        if (!at) continue;
+        printf("(%u play%s) ", sorted[i].plays, sorted[i].plays == 1 ? "" : "s");
+        print_track(&pl->items[at - 1], (size_t)at - 1);
+    }
+    hm_free(&pos);
+}
+
+/* Similar tracks: the words of a track's title, artist and album (tagged by
+   field, case-folded) form a set whose MinHash signature estimates Jaccard
+   similarity. The signature is cut into LSH_BANDS bands; tracks that agree
+   on a whole band share a bucket, so a query looks only at tracks in its
+   own buckets and ranks them by signature agreement. Signatures are kept by
+   track id. The index is built on the first query, then updated as tracks
+   are added; removed ids are skipped, and it is rebuilt once most of it is
+   dead. */
+typedef struct SimIndex {
+    unsigned int *sig;      /* MH_HASHES values per id */
+    unsigned int *next;     /* LSH_BANDS per id: next id in that bucket, 0 at end */
+    unsigned char *live;
+    size_t rows, nlive, ndead;
+    HashMap64 buckets[LSH_BANDS]; /* band hash -> first id */
+} SimIndex;
+typedef struct {
+    unsigned int id, agree; /* agree = signature values in common */
+} SimHit;
+
+static int cmp_u64(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+static int is_word_byte(unsigned char c) { return isalnum(c) || c >= 0x80; }
+/* Distinct field-tagged word hashes of t, sorted; returns the count */
+static size_t track_tokens(const Track *t, unsigned long long *out, size_t max) {
+    const char *fields[3] = {t->title, t->artist, t->album};
+    size_t n = 0;
+    for (int f = 0; f < 3; ++f) {
+        for (const char *s = fields[f]; *s;) {
+            if (!is_word_byte((unsigned char)*s)) { s++; continue; }
+            unsigned long long h = 0xCBF29CE484222325ull + (unsigned)f;
+            for (; is_word_byte((unsigned char)*s); ++s) h = (h ^ (unsigned char)tolower((unsigned char)*s)) * 0x100000001B3ull;
+            if (n < max) out[n++] = hash_mix(h);
+        }
+    }
+    qsort(out, n, sizeof(*out), cmp_u64);
+    size_t d = 0;
+    for (size_t i = 0; i < n; ++i) if (!d || out[d - 1] != out[i]) out[d++] = out[i];
+    return d;
+}
+/* Token hashes are already mixed, so the k-th hash function can be a
+   multiply-shift with its own random odd multiplier and xor key */
+static void minhash_signature(const unsigned long long *tok, size_t n, unsigned int *sig) {
+    for (int k = 0; k < MH_HASHES; ++k) {
+        unsigned long long a = hash_mix((unsigned long long)k + 1) | 1, x = hash_mix(~(unsigned long long)k);
+        unsigned int m = UINT_MAX;
+        for (size_t i = 0; i < n; ++i) {
+            unsigned int h = (unsigned int)(((tok[i] ^ x) * a) >> 32);
+            if (h < m) m = h;
+        }
+        sig[k] = m;
+    }
+}
+static unsigned long long band_key(const unsigned int *sig, int b) {
+    unsigned long long h = (unsigned long long)(b + 1) << 32;
+    for (int r = 0; r < LSH_ROWS; ++r) h = hash_mix(h ^ sig[b * LSH_ROWS + r]);
+    return h ? h : 1;
+}
+/* Puts id, whose signature is in place, at the head of its band buckets */
+static void sim_link(SimIndex *si, unsigned int id) {
+    const unsigned int *sig = &si->sig[(size_t)id * MH_HASHES];
+    for (int b = 0; b < LSH_BANDS; ++b) {
+        long long *head = hm_slot(&si->buckets[b], band_key(sig, b), 1);
+        si->next[(size_t)id * LSH_BANDS + b] = (unsigned int)*head;
+        *head = id;
+    }
+    si->live[id] = 1;
+    si->nlive++;
+}
+static void sim_track_added(SimIndex *si, const Track *t) {
+    unsigned long long tok[MAX_TOKENS];
+    size_t n = track_tokens(t, tok, MAX_TOKENS);
+    if (!n || !t->id) return;
+    if (t->id >= si->rows) {
+        size_t rows = si->rows ? si->rows : 1024;
+        while (rows <= t->id) rows *= 2;
+        si->sig = grow_zeroed(si->sig, si->rows * MH_HASHES, rows * MH_HASHES, sizeof(unsigned int));
+        si->next = grow_zeroed(si->next, si->rows * LSH_BANDS, rows * LSH_BANDS, sizeof(unsigned int));
+        si->live = grow_zeroed(si->live, si->rows, rows, 1);
+        si->rows = rows;
+    }
+    minhash_signature(tok, n, &si->sig[(size_t)t->id * MH_HASHES]);
+    sim_link(si, t->id);
+}
+static void sim_track_removed(SimIndex *si, const Track *t) {
+    if (t->id >= si->rows || !si->live[t->id]) return;
+    si->live[t->id] = 0;
+    si->nlive--;
+    si->ndead++;
+}
+static void sim_free(SimIndex *si) {
+    free(si->sig); free(si->next); free(si->live);
+    for (int b = 0; b < LSH_BANDS; ++b) hm_free(&si->buckets[b]);
+    memset(si, 0, sizeof(*si));
+}
+static void sim_build(SimIndex *si, const Playlist *pl) {
+    sim_free(si);
+    for (size_t i = 0; i < pl->size; ++i) sim_track_added(si, &pl->items[i]);
+}
+/* Moves live signatures to renumbered ids (remap[old] = new, 0 if gone)
+   and relinks the buckets without computing any signature again */
+static void sim_renumber(SimIndex *si, const unsigned int *remap, size_t nremap, unsigned int max_id) {
+    SimIndex old = *si;
+    memset(si, 0, sizeof(*si));
+    si->rows = 1024;
+    while (si->rows <= max_id) si->rows *= 2;
+    si->sig = calloc(si->rows * MH_HASHES, sizeof(unsigned int));
+    si->next = calloc(si->rows * LSH_BANDS, sizeof(unsigned int));
+    si->live = calloc(si->rows, 1);
+    if (!si->sig || !si->next || !si->live) { perror("calloc"); exit(1); }
+    for (size_t id = 1; id < old.rows && id < nremap; ++id) {
+        if (!old.live[id] || !remap[id]) continue;
+        memcpy(&si->sig[(size_t)remap[id] * MH_HASHES], &old.sig[id * MH_HASHES], MH_HASHES * sizeof(unsigned int));
+        sim_link(si, remap[id]);
+    }
+    sim_free(&old);
+}
+/* Up to k (>= 1) tracks sharing a bucket with id, most similar first */
+static size_t sim_query(const SimIndex *si, unsigned int id, SimHit *out, size_t k) {
+    if (id >= si->rows || !si->live[id]) return 0;
+    const unsigned int *q = &si->sig[(size_t)id * MH_HASHES];
+    HashSet64 seen = {0};
+    size_t n = 0;
+    for (int b = 0; b < LSH_BANDS; ++b) {
+        unsigned int c = (unsigned int)hm_get(&si->buckets[b], band_key(q, b));
+        for (size_t scanned = 0; c && scanned < LSH_SCAN_MAX; c = si->next[(size_t)c * LSH_BANDS + b], ++scanned) {
+            if (c == id || !si->live[c] || !hs_insert(&seen, c)) continue;
+            const unsigned int *s = &si->sig[(size_t)c * MH_HASHES];
+            unsigned int agree = 0;
+            for (int h = 0; h < MH_HASHES; ++h) agree += s[h] == q[h];
+            if (n == k && agree <= out[k - 1].agree) continue;
+            size_t i = n < k ? n++ : k - 1;
+            for (; i && out[i - 1].agree < agree; --i) out[i] = out[i - 1];
+            out[i].id = c;
+            out[i].agree = agree;
+        }
+    }
+    hs_free(&seen);
+    return n;
+}
+static void print_similar(SimIndex *si, const Playlist *pl, size_t idx, size_t k) {
+    if (si->ndead > si->nlive) sim_build(si, pl);
+    if (k > pl->size) k = pl->size;
+    SimHit *hits = malloc((k ? k : 1) * sizeof(SimHit));
+    if (!hits) { perror("malloc"); exit(1); }
+    double t0 = now_sec();
+    size_t n = k ? sim_query(si, pl->items[idx].id, hits, k) : 0;
+    double dt = now_sec() - t0;
+    HashMap64 pos = {0};
+    for (size_t i = 0; i < n; ++i) hm_slot(&pos, hits[i].id, 1);
+    index_ids(pl, &pos);
+    if (!n) puts("No similar tracks.");
+    for (size_t i = 0; i < n; ++i) {
+        long long at = hm_get(&pos, hits[i].id);
+        if (!at) continue;
+        printf("(~%3u%%) ", hits[i].agree * 100 / MH_HASHES);
+        print_track(&pl->items[at - 1], (size_t)at - 1);
+    }
+    printf("(%.3f ms)\n", dt * 1e3);
+    hm_free(&pos);
+    free(hits);
+}
+static double jaccard_sorted(const unsigned long long *a, size_t na, const unsigned long long *b, size_t nb) {
+    size_t i = 0, j = 0, common = 0;
+    while (i < na && j < nb) {
+        if (a[i] == b[j]) { common++; i++; j++; }
+        else if (a[i] < b[j]) i++;
+        else j++;
+    }
+    return na + nb ? (double)common / (double)(na + nb - common) : 0.0;
+}
+/* Recall@10 and latency of the LSH query against exact brute-force
+   Jaccard. A hit counts as relevant if its exact similarity is at least the
+   10th best, so ties do not penalize either side. */
+static void bench_similar(size_t n) {
+    enum { TOPK = 10, QUERIES = 100 };
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    SimIndex si;
+    memset(&si, 0, sizeof(si));
+    double t0 = now_sec();
+    sim_build(&si, &pl);
+    double build = now_sec() - t0;
+    size_t *off = malloc((n + 1) * sizeof(size_t));
+    unsigned long long *tok = NULL, one[MAX_TOKENS];
+    size_t ntok = 0, cap = 0;
+    if (!off) { perror("malloc"); exit(1); }
+    for (size_t i = 0; i < n; ++i) {
+        size_t m = track_tokens(&pl.items[i], one, MAX_TOKENS);
+        if (ntok + m > cap) {
+            cap = (ntok + m) * 2;
+            tok = realloc(tok, cap * sizeof(*tok));
+            if (!tok) { perror("realloc"); exit(1); }
+        }
+        off[i] = ntok;
+        memcpy(tok + ntok, one, m * sizeof(*tok));
+        ntok += m;
+    }
+    off[n] = ntok;
+    size_t nq = n < QUERIES ? n : QUERIES, want = n - 1 < TOPK ? n - 1 : TOPK;
+    double lsh = 0, brute = 0, recall = 0;
+    for (size_t q = 0; q < nq && want; ++q) {
+        size_t qi = (q * 0x9E3779B9u) % n;
+        SimHit hits[TOPK];
+        t0 = now_sec();
+        size_t nh = sim_query(&si, pl.items[qi].id, hits, TOPK);
+        lsh += now_sec() - t0;
+        double best[TOPK];
+        size_t nb = 0;
+        t0 = now_sec();
+        for (size_t i = 0; i < n; ++i) {
+            if (i == qi) continue;
+            double j = jaccard_sorted(tok + off[qi], off[qi + 1] - off[qi], tok + off[i], off[i + 1] - off[i]);
+            if (nb == TOPK && j <= best[TOPK - 1]) continue;
+            size_t k = nb < TOPK ? nb++ : TOPK - 1;
+            for (; k && best[k - 1] < j; --k) best[k] = best[k - 1];
+            best[k] = j;
+        }
+        brute += now_sec() - t0;
+        size_t good = 0;
+        for (size_t h = 0; h < nh; ++h) {
+            size_t i = hits[h].id - 1; /* synthetic ids are index + 1 */
+            if (jaccard_sorted(tok + off[qi], off[qi + 1] - off[qi], tok + off[i], off[i + 1] - off[i]) >= best[want - 1]) good++;
+        }
+        recall += (double)good / (double)want;
+    }
+    printf("bench similar: %zu tracks, %d-value signatures in %d bands, %zu queries\n", n, MH_HASHES, LSH_BANDS, nq);
+    printf(" index build: %8.3f ms  %6.1f ns/track\n", build * 1e3, build * 1e9 / (double)n);
+    if (nq && want) {
+        printf(" lsh query:   %8.3f ms avg  recall@%zu %.1f%%\n", lsh * 1e3 / (double)nq, want, recall * 100 / (double)nq);
+        printf(" brute force: %8.3f ms avg\n", brute * 1e3 / (double)nq);
+    }
+    free(off); free(tok);
+    sim_free(&si);
+    free_playlist(&pl);
+}
+
+/* Memory footprint, estimated from counters kept as tracks come and go so
+   it is O(1) to check after every command. Waste is what compaction would
+   give back: array slack, holes left by freed strings, blob bytes of
+   removed tracks, and id-indexed rows of ids no longer in use. */
+typedef struct {
+    size_t items, slack;      /* track array, and its unused tail */
+    size_t strings, overhead; /* live string bytes, est. allocator overhead */
+    size_t holes;             /* freed or orphaned string bytes */
+    size_t meta, meta_dead;   /* metadata columns, rows of dead ids */
+    size_t sim, sim_dead;     /* similarity index, rows of dead ids */
+    size_t total, waste;
+} Footprint;
+static int g_compact_auto = COMPACT_AUTO_PCT; /* 0 = off */
+
+static size_t meta_rows_for(size_t max_id) {
+    size_t n = 1024;
+    while (n <= max_id) n *= 2;
+    return n;
+}
+static void playlist_footprint(const Playlist *pl, Footprint *fp) {
+    const size_t meta_row = 2 * sizeof(unsigned short) + 2 + sizeof(unsigned int) + sizeof(long long) + sizeof(char *);
+    const size_t sim_row = (MH_HASHES + LSH_BANDS) * sizeof(unsigned int) + 1;
+    memset(fp, 0, sizeof(*fp));
+    fp->items = pl->cap * sizeof(Track);
+    fp->slack = sub_floor0(pl->cap, pl->size > INITIAL_CAP ? pl->size : INITIAL_CAP) * sizeof(Track);
+    fp->strings = pl->str_bytes;
+    fp->overhead = (pl->size - pl->blob_tracks) * TRACK_OVERHEAD;
+    fp->holes = pl->hole_bytes + pl->blob_dead;
+    if (pl->meta.rows) {
+        fp->meta = pl->meta.rows * meta_row;
+        fp->meta_dead = sub_floor0(pl->meta.rows, meta_rows_for(pl->size)) * meta_row;
+    }
+    if (pl->sim) {
+        fp->sim = pl->sim->rows * sim_row;
+        fp->sim_dead = pl->sim->ndead * sim_row;
+    }
+    fp->total = fp->items + fp->strings + fp->overhead + fp->holes + fp->meta + fp->sim;
+    fp->waste = fp->slack + fp->holes + fp->meta_dead + fp->sim_dead;
+}
+static int compact_due(const Playlist *pl) {
+    Footprint fp;
+    playlist_footprint(pl, &fp);
+    return g_compact_auto && fp.waste >= COMPACT_MIN_WASTE && fp.waste * 100 > fp.total * (size_t)g_compact_auto;
+}
+static void print_footprint(const Playlist *pl) {
+    Footprint fp;
+    playlist_footprint(pl, &fp);
+    printf("Tracks:     %zu in an array of %zu: %zu KB (%zu KB unused)\n", pl->size, pl->cap, fp.items / 1024, fp.slack / 1024);
+    printf("Strings:    %zu KB, %zu of %zu tracks packed; ~%zu KB allocator overhead\n",
+           fp.strings / 1024, pl->blob_tracks, pl->size, fp.overhead / 1024);
+    printf("Holes:      %zu KB freed or orphaned since the last compact\n", fp.holes / 1024);
+    printf("Metadata:   %zu KB (%zu KB for ids no longer in use)\n", fp.meta / 1024, fp.meta_dead / 1024);
+    printf("Similarity: %zu KB (%zu KB for removed tracks)\n", fp.sim / 1024, fp.sim_dead / 1024);
+    printf("Total:      ~%zu KB, %.1f%% reclaimable by compact", fp.total / 1024,
+           fp.total ? 100.0 * (double)fp.waste / (double)fp.total : 0.0);
+    if (g_compact_auto) printf(" (auto at %d%%)\n", g_compact_auto);
+    else puts(" (auto off)");
+}
+
+/* Compaction: shrinks the track array to fit, packs the strings (see
+   pack_strings), and renumbers ids 1..size so the id-indexed
+   metadata columns shrink with it. Smart memberships are rebuilt and the
+   play history is remapped to the new ids (plays of tracks that are gone
+   keep an id that is never handed out), and the similarity index keeps its
+   signatures under the new ids. Returns the estimated bytes reclaimed. */
+static size_t compact_playlist(Playlist *pl, PlayHistory *h) {
+    double span = trace_begin();
+    Footprint before, after;
+    playlist_footprint(pl, &before);
+    size_t n = pl->size;
+    unsigned int *remap = calloc(pl->next_id, sizeof(unsigned int));
+    if (!remap) { perror("calloc"); exit(1); }
+
+    MetaColumns old = pl->meta, *m = &pl->meta;
+    if (old.rows) {
+        memset(m, 0, sizeof(*m));
+        m->genres = old.genres; m->ngenres = old.ngenres; m->genre_ids = old.genre_ids;
+        m->plays_epoch = old.plays_epoch + 1;
+        meta_reserve(m, (unsigned int)n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        Track *t = &pl->items[i];
+        unsigned int id = (unsigned int)i + 1, was = t->id;
+        if (old.rows && was < old.rows) {
+            m->genre[id] = old.genre[was]; m->year[id] = old.year[was];
+            m->track_no[id] = old.track_no[was]; m->rating[id] = old.rating[was];
+            m->plays[id] = old.plays[was]; m->last_played[id] = old.last_played[was];
+            m->path[id] = old.path[was];
+        }
+        if (was < pl->next_id) remap[was] = id;
+        t->id = id;
+    }
+    if (old.rows) {
+        free(old.genre); free(old.year); free(old.track_no); free(old.rating);
+        free(old.plays); free(old.last_played); free(old.path);
+    }
+    pack_strings(pl);
+
+    if (h) {
+        for (size_t i = 0; i < h->count; ++i) {
+            PlayEvent *e = &h->ring[(h->head + RECENT_CAP - 1 - i) % RECENT_CAP];
+            e->id = e->id < pl->next_id && remap[e->id] ? remap[e->id] : UINT_MAX;
+        }
+        top_rebuild(h, m);
+    }
+    if (pl->sim) sim_renumber(pl->sim, remap, pl->next_id, (unsigned int)n);
+    pl->next_id = (unsigned int)n + 1;
+    free(remap);
+    if (pl->smart) {
+        for (size_t r = 0; r < pl->smart->n; ++r) idset_free(&pl->smart->rules[r].members);
+        for (size_t i = 0; i < n; ++i) smart_track_added(pl->smart, &pl->items[i]);
+    }
+
+    size_t cap = n > INITIAL_CAP ? n : INITIAL_CAP;
+    if (cap < pl->cap) {
+        Track *items = realloc(pl->items, cap * sizeof(Track));
+        if (!items) { perror("realloc"); exit(1); }
+        pl->items = items;
+        pl->cap = cap;
+    }
+    playlist_footprint(pl, &after);
+    trace_end("compact", span, (long long)n);
+    return sub_floor0(before.total, after.total);
+}
+
+/* Sampling without touching playlist order. Picks come from a xorshift64*
+   generator seeded once per run. An unfiltered sample uses Floyd's
+   algorithm over track positions and a smart playlist sample uses it over
+   the member array, both O(K); a rule sample is one reservoir pass over the
+   tracks that match. */
+static unsigned long long g_rng;
+static unsigned long long rng_next(void) {
+    if (!g_rng) g_rng = hash_mix((unsigned long long)time(NULL) ^ ((unsigned long long)getpid() << 32)) | 1;
+    g_rng ^= g_rng >> 12; g_rng ^= g_rng << 25; g_rng ^= g_rng >> 27;
+    return g_rng * 0x2545F4914F6CDD1Dull;
+}
+/* Uniform in [0, n), n > 0, by rejection */
+static size_t rng_below(size_t n) {
+    unsigned long long limit = ULLONG_MAX - ULLONG_MAX % n, r;
+    while ((r = rng_next()) >= limit) {}
+    return (size_t)(r % n);
+}
+static void shuffle_indices(size_t *a, size_t n) {
+    for (size_t i = n; i > 1; --i) {
+        size_t j = rng_below(i), t = a[i - 1];
+        a[i - 1] = a[j]; a[j] = t;
+    }
+}
+/* Floyd: k distinct values from [0, n) in random order, k <= n */
+static void sample_floyd(size_t n, size_t k, size_t *out) {
+    HashSet64 seen = {0};
+    size_t m = 0;
+    for (size_t j = n - k; j < n; ++j) {
+        size_t t = rng_below(j + 1);
+        out[m++] = hs_insert(&seen, t + 1) ? t : (hs_insert(&seen, j + 1), j);
+    }
+    hs_free(&seen);
+    shuffle_indices(out, k);
+}
+/* Reservoir: up to k positions of tracks matching every predicate, in
+   random order; returns how many were kept */
+static size_t sample_reservoir(const Playlist *pl, const Predicate *preds, size_t npreds, size_t k, size_t *out) {
+    size_t seen = 0;
+    for (size_t i = 0; i < pl->size; ++i) {
+        size_t p = 0;
+        while (p < npreds && predicate_holds(&preds[p], &pl->items[i])) p++;
+        if (p < npreds) continue;
+        if (seen < k) out[seen] = i;
+        else { size_t j = rng_below(seen + 1); if (j < k) out[j] = i; }
+        seen++;
+    }
+    size_t kept = seen < k ? seen : k;
+    shuffle_indices(out, kept);
+    return kept;
+}
+/* Prints a sample of k tracks; filter is NULL, "smart NAME" or a rule.
+   Returns 0 if the filter is invalid. */
+static int print_sample(const Playlist *pl, SmartSet *smart, size_t k, const char *filter) {
+    if (k > pl->size) k = pl->size; /* every population below is a subset of pl */
+    size_t *pick = malloc((k ? k : 1) * sizeof(size_t)), n = 0;
+    if (!pick) { perror("malloc"); exit(1); }
+    if (!filter) {
+        n = k < pl->size ? k : pl->size;
+        sample_floyd(pl->size, n, pick);
+    } else if (strncasecmp(filter, "smart ", 6) == 0) {
+        SmartPlaylist *sp = smart_find(smart, filter + 6);
+        if (!sp) { free(pick); return 0; }
+        n = k < sp->members.n ? k : sp->members.n;
+        sample_floyd(sp->members.n, n, pick);
+        /* members are ids; one pass maps the picked ones to positions */
+        HashMap64 pos = {0};
+        for (size_t i = 0; i < n; ++i) hm_slot(&pos, sp->members.ids[pick[i]], 1);
+        index_ids(pl, &pos);
+        for (size_t i = 0; i < n; ++i) pick[i] = (size_t)hm_get(&pos, sp->members.ids[pick[i]]) - 1;
+        hm_free(&pos);
+    } else {
+        Predicate *preds;
+        size_t np;
+        if (!parse_rule(filter, &preds, &np)) { free(pick); return 0; }
+        n = sample_reservoir(pl, preds, np, k, pick);
+        for (size_t i = 0; i < np; ++i) free(preds[i].text);
+        free(preds);
+    }
+    if (!n) puts("No tracks to sample.");
+    for (size_t i = 0; i < n; ++i) print_track(&pl->items[pick[i]], pick[i]);
+    free(pick);
+    return 1;
+}
+
+/* Performance regression gate: `music --perfgate BASELINE [--threshold PCT]
+   [--runs N] [--tracks N] [--update]` times each scenario on a generated
+   playlist several times and compares the median with the stored baseline.
+   An operation regresses only if its median is more than PCT% slower AND
+   the difference exceeds 3 MADs (median absolute deviation, the larger of
+   the two sides), so one noisy run cannot fail the gate. Exits 1 on a
+   regression, 2 on bad usage; a missing baseline (or --update) records one. */
+enum { GATE_LOAD, GATE_SAVE, GATE_SEARCH, GATE_SORT, GATE_SHUFFLE, GATE_LIST, GATE_OPS };
+static const char *const gate_names[GATE_OPS] = {"load", "save", "search", "sort", "shuffle", "list"};
+typedef struct {
+    double median, mad; /* ms */
+    int have;
+} GateStat;
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+/* Median of v[0..n) (reordered) and the MAD around it */
+static GateStat gate_stat(double *v, size_t n) {
+    GateStat st = {0, 0, 1};
+    qsort(v, n, sizeof(double), cmp_double);
+    st.median = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    for (size_t i = 0; i < n; ++i) v[i] = v[i] > st.median ? v[i] - st.median : st.median - v[i];
+    qsort(v, n, sizeof(double), cmp_double);
+    st.mad = n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+    return st;
+}
+/* Runs every scenario `runs` times on n generated tracks; output is muted */
+static void gate_measure(size_t n, int runs, GateStat *out) {
+    char csv[MAX_LINE];
+    const char *tmpdir = getenv("TMPDIR");
+    snprintf(csv, sizeof(csv), "%s/perfgate-XXXXXX", tmpdir && *tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemp(csv);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w");
+    if (!f) { perror("perfgate temp file"); exit(2); }
+    Playlist pl;
+    init_playlist(&pl);
+    for (size_t i = 0; i < n; ++i) {
+        ensure_capacity(&pl);
+        synth_track(&pl.items[pl.size++], i);
+    }
+    pl.next_id = (unsigned int)n + 1;
+    write_playlist_csv(&pl, f);
+    fclose(f);
+    char saved[sizeof(csv) + 4];
+    snprintf(saved, sizeof(saved), "%s.out", csv);
+    FsyncPolicy policy = g_fsync_policy;
+    g_fsync_policy = FSYNC_NEVER; /* time our code, not the disk */
+    fflush(stdout);
+    int out_fd = dup(1), null_fd = open("/dev/null", O_WRONLY);
+    if (out_fd < 0 || null_fd < 0) { perror("perfgate"); exit(2); }
+    dup2(null_fd, 1);
+    double *t = malloc((size_t)runs * GATE_OPS * sizeof(double));
+    if (!t) { perror("malloc"); exit(1); }
+    for (int r = 0; r < runs; ++r) {
+        double t0 = now_sec();
+        Playlist loaded;
+        init_playlist(&loaded);
+        load_playlist(&loaded, csv); /* as the load command does */
+        place_strings(&loaded);
+        t[GATE_LOAD * runs + r] = now_sec() - t0;
+        free_playlist(&loaded);
+        t0 = now_sec();
+        save_playlist(&pl, saved);
+        t[GATE_SAVE * runs + r] = now_sec() - t0;
+        t0 = now_sec();
+        search_playlist(&pl, "ghost river");
+        t[GATE_SEARCH * runs + r] = now_sec() - t0;
+        t0 = now_sec();
+        shuffle_playlist(&pl);
+        t[GATE_SHUFFLE * runs + r] = now_sec() - t0;
+        t0 = now_sec();
+        sort_playlist(&pl, SORT_TITLE);
+        t[GATE_SORT * runs + r] = now_sec() - t0;
+        t0 = now_sec();
+        list_playlist(&pl);
+        fflush(stdout);
+        t[GATE_LIST * runs + r] = now_sec() - t0;
+    }
+    fflush(stdout);
+    dup2(out_fd, 1);
+    close(out_fd); close(null_fd);
+    g_fsync_policy = policy;
+    for (int op = 0; op < GATE_OPS; ++op) {
+        for (int r = 0; r < runs; ++r) t[op * runs + r] *= 1e3;
+        out[op] = gate_stat(&t[op * runs], (size_t)runs);
+    }
+    free(t);
+    unlink(csv); unlink(saved);
+    free_playlist(&pl);
+}
+/* Baseline lines: "op median_ms mad_ms tracks"; returns 0 if unreadable */
+static int gate_read(const char *path, GateStat *base, size_t *tracks) {
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    char line[MAX_LINE], name[32];
+    double med, mad;
+    size_t n;
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#' || sscanf(line, "%31s %lf %lf %zu", name, &med, &mad, &n) != 4) continue;
+        for (int op = 0; op < GATE_OPS; ++op)
+            if (strcmp(name, gate_names[op]) == 0) { base[op].median = med; base[op].mad = mad; base[op].have = 1; *tracks = n; }
+    }
+    fclose(f);
+    return 1;
+}
+static int gate_write(const char *path, const GateStat *st, size_t tracks, int runs) {
+    char tmp[MAX_LINE + 32];
+    FILE *f = atomic_begin(path, tmp);
+    if (!f) return 0;
+    fprintf(f, "# perfgate baseline: op median_ms mad_ms tracks (%d runs)\n", runs);
+    for (int op = 0; op < GATE_OPS; ++op) fprintf(f, "%s %.4f %.4f %zu\n", gate_names[op], st[op].median, st[op].mad, tracks);
+    return atomic_finish(f, tmp, path, !ferror(f));
+}
+static int perf_gate(int argc, char **argv) {
+    const char *baseline = NULL;
+    double threshold = PERFGATE_THRESHOLD;
+    int runs = PERFGATE_RUNS, update = 0;
+    size_t tracks = PERFGATE_TRACKS;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "--update") == 0) update = 1;
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--runs") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--tracks") == 0 && i + 1 < argc) tracks = strtoul(argv[++i], NULL, 10);
+        else if (!baseline && argv[i][0] != '-') baseline = argv[i];
+        else baseline = NULL, i = argc;
+    }
+    if (!baseline || runs < 3 || tracks == 0 || threshold <= 0) {
+        fprintf(stderr, "usage: music --perfgate BASELINE [--threshold PCT] [--runs N>=3] [--tracks N] [--update]\n");
+        return 2;
+    }
+    GateStat base[GATE_OPS], cur[GATE_OPS];
+    size_t base_tracks = 0;
+    memset(base, 0, sizeof(base));
+    int have = !update && gate_read(baseline, base, &base_tracks);
+    if (have && base_tracks != tracks) {
+        fprintf(stderr, "perfgate: %s was recorded with %zu tracks; rerun with --tracks %zu or --update\n", baseline, base_tracks, base_tracks);
+        return 2;
+    }
+    printf("perfgate: %zu tracks, %d runs per operation, threshold %.1f%%\n", tracks, runs, threshold);
+    gate_measure(tracks, runs, cur);
+    if (!have) {
+        if (!gate_write(baseline, cur, tracks, runs)) { perror(baseline); return 2; }
+        for (int op = 0; op < GATE_OPS; ++op) printf(" %-8s %10.3f ms ±%.3f\n", gate_names[op], cur[op].median, cur[op].mad);
+        printf("Baseline written to %s\n", baseline);
+        return 0;
+    }
+    int regressions = 0;
+    printf(" %-8s %18s %18s %8s\n", "op", "baseline ms", "current ms", "change");
+    for (int op = 0; op < GATE_OPS; ++op) {
+        if (!base[op].have) { printf(" %-8s %18s %11.3f ±%-5.3f %8s  new\n", gate_names[op], "-", cur[op].median, cur[op].mad, ""); continue; }
+        double diff = cur[op].median - base[op].median;
+        double change = base[op].median > 0 ? diff * 100 / base[op].median : 0;
+        double noise = 3 * (cur[op].mad > base[op].mad ? cur[op].mad : base[op].mad);
+        int bad = change > threshold && diff > noise;
+        regressions += bad;
+        printf(" %-8s %11.3f ±%-5.3f %11.3f ±%-5.3f %+7.1f%%  %s\n", gate_names[op], base[op].median, base[op].mad,
+               cur[op].median, cur[op].mad, change, bad ? "REGRESSION" : change < -threshold && -diff > noise ? "faster" : "ok");
+    }
+    if (regressions) printf("FAILED: %d operation%s slower than %s by more than %.1f%%\n", regressions, regressions == 1 ? "" : "s", baseline, threshold);
+    else printf("PASSED\n");
+    return regressions ? 1 : 0;
+}
+
+/* Per-command latency, recorded by the dispatcher into HDR-style log-linear
+   histograms: values below HIST_SUB ns are exact, above that each power of
+   two is split into HIST_SUB buckets, so every recorded value is within
+   ~1.6% of its bucket's bounds whatever its magnitude. Percentiles report
+   the bucket's upper bound, as HdrHistogram does; max is exact. Time spent
+   waiting at prompts (e.g. add) is excluded. */
+typedef struct {
+    char name[16];
+    unsigned long long count, max_ns;
+    unsigned long long buckets[HIST_BUCKETS];
+} CmdHist;
+static CmdHist *g_hist[HIST_MAX_CMDS];
+static size_t g_nhist;
+
+static size_t hist_index(unsigned long long v) {
+    if (v < HIST_SUB) return (size_t)v;
+    int e = 63 - __builtin_clzll(v);
+    if (e > HIST_MAX_EXP) return HIST_BUCKETS - 1;
+    int shift = e - HIST_SUB_BITS;
+    return HIST_SUB + (size_t)shift * HIST_SUB + (size_t)((v >> shift) - HIST_SUB);
+}
+/* Largest value that lands in bucket i */
+static unsigned long long hist_upper(size_t i) {
+    if (i < HIST_SUB) return i;
+    size_t shift = (i - HIST_SUB) / HIST_SUB, sub = (i - HIST_SUB) % HIST_SUB;
+    return ((unsigned long long)(HIST_SUB + sub + 1) << shift) - 1;
+}
+static void hist_record(const char *cmd, double sec) {
+    CmdHist *h = NULL;
+    for (size_t i = 0; i < g_nhist && !h; ++i) if (strcmp(g_hist[i]->name, cmd) == 0) h = g_hist[i];
+    if (!h) {
+        if (g_nhist == HIST_MAX_CMDS) return;
+        h = g_hist[g_nhist++] = calloc(1, sizeof(CmdHist));
+        if (!h) { perror("calloc"); exit(1); }
+        snprintf(h->name, sizeof(h->name), "%s", cmd);
+    }
+    unsigned long long ns = sec > 0 ? (unsigned long long)(sec * 1e9) : 0;
+    h->buckets[hist_index(ns)]++;
+    h->count++;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+/* Value at quantile q (0..1]: the upper bound of the bucket holding it */
+static unsigned long long hist_quantile(const CmdHist *h, double q) {
+    unsigned long long target = (unsigned long long)(q * (double)h->count + 0.999999), seen = 0;
+    if (!target) target = 1;
+    for (size_t i = 0; i < HIST_BUCKETS; ++i) {
+        seen += h->buckets[i];
+        if (seen >= target) return hist_upper(i) < h->max_ns ? hist_upper(i) : h->max_ns;
+    }
+    return h->max_ns;
+}
+static const double hist_q[5] = {0.50, 0.90, 0.99, 0.999, 1.0};
+static void print_latency(void) {
+    if (!g_nhist) { puts("No commands timed yet."); return; }
+    printf(" %-12s %8s %10s %10s %10s %10s %10s  (ms)\n", "command", "count", "p50", "p90", "p99", "p999", "max");
+    for (size_t i = 0; i < g_nhist; ++i) {
+        const CmdHist *h = g_hist[i];
+        printf(" %-12s %8llu", h->name, h->count);
+        for (int q = 0; q < 5; ++q) printf(" %10.3f", (double)hist_quantile(h, hist_q[q]) / 1e6);
+        putchar('\n');
+    }
+}
+/* Summary lines "cmd count p50 p90 p99 p999 max" (ns), then every non-empty
+   bucket as "bucket cmd upper_ns count", so builds can be compared */
+static int dump_latency(const char *path) {
+    char tmp[MAX_LINE + 32];
+    FILE *f = atomic_begin(path, tmp);
+    if (!f) return 0;
+    fprintf(f, "# latency histograms, built %s %s\n# cmd count p50 p90 p99 p999 max (ns)\n", __DATE__, __TIME__);
+    for (size_t i = 0; i < g_nhist; ++i) {
+        fprintf(f, "%s %llu", g_hist[i]->name, g_hist[i]->count);
+        for (int q = 0; q < 5; ++q) fprintf(f, " %llu", hist_quantile(g_hist[i], hist_q[q]));
+        fputc('\n', f);
+    }
+    for (size_t i = 0; i < g_nhist; ++i)
+        for (size_t b = 0; b < HIST_BUCKETS; ++b)
+            if (g_hist[i]->buckets[b]) fprintf(f, "bucket %s %llu %llu\n", g_hist[i]->name, hist_upper(b), g_hist[i]->buckets[b]);
+    return atomic_finish(f, tmp, path, !ferror(f));
+}
+static void free_latency(void) {
+    for (size_t i = 0; i < g_nhist; ++i) free(g_hist[i]);
+    g_nhist = 0;
+}
+
+/* Interactive menu */
+static void print_help(void) {
+    puts("\nCommands:");
+    puts(" add        - add a new track");
+    puts(" list       - list all tracks");
+    puts(" list --sorted-by title|artist|dur [--limit N] [--desc] - sorted view, order unchanged");
+    puts(" remove N   - remove track at index N (1-based)");
+    puts(" search X   - search title/artist/album for X");
+    puts(" filter EXPR- tracks whose metadata matches, e.g. filter year>=1990 genre=rock");
+    puts(" meta N [field=value ...] - show or set genre|year|track|rating|plays|last_played|path");
+    puts(" shuffle    - shuffle playlist");
+    puts(" sample K [smart NAME | RULE] - K random tracks, e.g. sample 5 artist=Queen (order unchanged)");
+    puts(" sort title - sort by title");
+    puts(" sort artist- sort by artist then title");
+    puts(" sort dur   - sort by duration ascending (stable)");
+    puts(" play N     - play track N (simulated)");
+    puts(" recent [K] - last K plays, newest first (default 10)");
+    puts(" top [K]    - K most played tracks (default 10, at most 100)");
+    puts(" top N by title|artist|dur [asc|desc] - first N by key (dur: longest first)");
+    puts(" similar N [K] - K tracks most like track N by title/artist/album words (default 10)");
+    puts(" relayout [auto on|off] - rewrite strings in playlist order (done after each load unless off)");
+    puts(" memory     - estimated memory footprint and how much compact would reclaim");
+    puts(" compact [auto PCT|off] - pack tracks and strings now, or set the automatic threshold");
+    puts(" union|intersect|diff OUT A B [C...] - set operation over playlist files into OUT");
+    puts(" compare OLD NEW [summary] - order-aware changes between two playlist files");
+    puts(" merge BASE OURS THEIRS OUT - three-way merge of playlist versions into OUT");
+    puts(" paged open F [KB [DIR]] | list | search X | play N | remove N | save F | stats | close");
+    puts("            - work on a file larger than memory through a KB-sized page cache");
+    puts(" extsort K in out [MB] - sort CSV file by K (title|artist|dur) within MB of memory");
+    puts(" save [f]   - save playlist to file (default: playlist.csv; *.plb = binary)");
+    puts(" load [f]   - load playlist from file and append (default: playlist.csv)");
+    puts(" publish [n]- publish playlist to shared memory (default: playlist)");
+    puts(" peek [n] [find T] - list (or look up title T in) a published playlist");
+    puts(" clear      - clear playlist (destructive)");
+    puts(" fsync P    - durability policy: always | batched | never");
+    puts(" smart add NAME RULE - e.g. smart add short artist=Queen dur<240 (ops = != ~ < <= > >=)");
+    puts(" smart [list] | smart show NAME | smart del NAME - smart playlists");
+    puts(" watch [f|off] - apply external edits to f (default: playlist.csv) as they happen");
+    puts(" bench K [N]- run benchmark K (scan|prefetch|fsync|extsort|similar|relayout|sort) on N synthetic tracks");
+    puts(" latency [dump F | reset] - per-command p50/p90/p99/p999/max, or write them to F");
+    puts(" trace on|off|dump [F] - record per-thread spans; Chrome trace JSON to F (" DEFAULT_TRACE ", also on quit)");
+    puts(" help       - show this help");
+    puts(" quit       - save and exit\n");
+}
+
+/* Parse integer from token, return -1 if invalid */
+static int parse_index_token(const char *tok, int max) {
+    if (!tok) return -1;
+    char *end; long v = strtol(tok, &end, 10);
+    if (*end != '\0' || v < 1 || v > max) return -1;
+    return (int)v - 1;
+}
+
+#ifdef PLAYLIST_FUZZ
+/* Differential fuzz target. The input is written out as a playlist CSV and
+   loaded by the reference path (load_playlist_csv); every other path that
+   turns the same bytes into tracks must agree with it field for field: a
+   .plb round trip (also with its index damaged, so the block scan has to
+   recover everything), a CSV save and reload, paged mode and watch sync.
+   The raw bytes also go through load_playlist_any, which reaches the binary
+   reader for inputs starting with "PLBF"; those have no reference, so the
+   playlist only has to come out consistent. Any difference aborts, so the
+   fuzzer keeps the input. New fast paths for the I/O code belong in
+   LLVMFuzzerTestOneInput next to these. */
+static void fuzz_expect(const char *what, const Playlist *ref, const Playlist *got, int with_meta) {
+    if (got->size != ref->size) {
+        fprintf(stderr, "fuzz: %s produced %zu tracks, reference %zu\n", what, got->size, ref->size);
+        abort();
+    }
+    for (size_t i = 0; i < ref->size; ++i) {
+        const Track *a = &ref->items[i], *b = &got->items[i];
+        const char *field = strcmp(a->title, b->title) ? "title" : strcmp(a->artist, b->artist) ? "artist"
+                          : strcmp(a->album, b->album) ? "album" : a->duration != b->duration ? "duration" : NULL;
+        for (int f = 0; !field && with_meta && f < META_NFIELDS; ++f) {
+            char x[32], y[32];
+            if (strcmp(meta_text(&ref->meta, a->id, (MetaField)f, x, sizeof(x)), meta_text(&got->meta, b->id, (MetaField)f, y, sizeof(y))))
+                field = meta_field_names[f];
+        }
+        if (field) {
+            fprintf(stderr, "fuzz: %s differs from the reference at track %zu (%s)\n", what, i + 1, field);
+            abort();
+        }
+    }
+}
+static void fuzz_check(const char *what, const Playlist *pl) {
+    HashSet64 ids = {0};
+    size_t bytes = 0;
+    for (size_t i = 0; i < pl->size; ++i) {
+        const Track *t = &pl->items[i];
+        if (!t->title || !t->artist || !t->album || !t->id || t->id >= pl->next_id || !hs_insert(&ids, t->id)) {
+            fprintf(stderr, "fuzz: %s left track %zu inconsistent\n", what, i + 1);
+            abort();
+        }
+        bytes += track_str_bytes(t);
+    }
+    if (pl->size > pl->cap || bytes != pl->str_bytes) {
+        fprintf(stderr, "fuzz: %s left the playlist inconsistent (%zu/%zu tracks, %zu/%zu string bytes)\n",
+                what, pl->size, pl->cap, bytes, pl->str_bytes);
+        abort();
+    }
+    hs_free(&ids);
+}
+static int fuzz_collect_cb(const Track *t, size_t idx, void *ctx) {
+    (void)idx;
+    add_track((Playlist *)ctx, t->title, t->artist, t->album, t->duration);
+    return 1;
+}
+static FILE *fuzz_temp(char *path) {
+    strcpy(path, "/tmp/plfuzz-XXXXXX");
+    int fd = mkstemp(path);
+    FILE *f = fd < 0 ? NULL : fdopen(fd, "w+b");
+    if (!f) { perror("fuzz temp file"); exit(1); }
+    return f;
+}
+/* Flips the first index byte of a .plb so its CRC no longer matches;
+   returns 0 if the file has no index entries to damage */
+static int fuzz_damage_index(const char *path) {
+    FILE *f = fopen(path, "r+b");
+    unsigned char tr[PLB_TRAILER_LEN];
+    int ok = f && fseek(f, -PLB_TRAILER_LEN, SEEK_END) == 0 && fread(tr, 1, sizeof(tr), f) == sizeof(tr) &&
+             get_u32(tr + 8) > 0 && fseeko(f, (off_t)get_u64(tr), SEEK_SET) == 0;
+    int c = ok ? fgetc(f) : EOF;
+    ok = c != EOF && fseeko(f, (off_t)get_u64(tr), SEEK_SET) == 0 && fputc(c ^ 0xFF, f) != EOF;
+    if (f) fclose(f);
+    return ok;
+}
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size);
+int LLVMFuzzerTestOneInput(const unsigned char *data, size_t size) {
+    char csv[32], bin[32], resaved[32];
+    FILE *f = fuzz_temp(csv);
+    fwrite(data, 1, size, f);
+    fclose(f);
+    Playlist ref, got;
+    init_playlist(&ref);
+    load_playlist_csv(&ref, csv);
+    init_playlist(&got);
+    load_playlist_any(&got, csv);
+    fuzz_check("raw load", &got);
+    free_playlist(&got);
+
+    f = fuzz_temp(bin);
+    write_playlist_bin(&ref, f);
+    fclose(f);
+    init_playlist(&got);
+    load_playlist(&got, bin);
+    fuzz_expect("plb round trip", &ref, &got, 1);
+    free_playlist(&got);
+    if (fuzz_damage_index(bin)) {
+        init_playlist(&got);
+        load_playlist(&got, bin);
+        fuzz_expect("plb damaged index", &ref, &got, 1);
+        free_playlist(&got);
+    }
+
+    f = fuzz_temp(resaved);
+    write_playlist_csv(&ref, f);
+    fclose(f);
+    init_playlist(&got);
+    load_playlist_csv(&got, resaved);
+    fuzz_expect("csv save/reload", &ref, &got, 1);
+    free_playlist(&got);
+
+    PagedStore ps;
+    init_playlist(&got);
+    if (paged_open(&ps, csv, 2 * PAGED_PAGE_SIZE, NULL)) { /* refused when metadata columns are present */
+        paged_each(&ps, fuzz_collect_cb, &got);
+        paged_close(&ps);
+        fuzz_expect("paged", &ref, &got, 0);
+    }
+    free_playlist(&got);
+
+    FileWatch w;
+    size_t added, removed;
+    memset(&w, 0, sizeof(w));
+    w.fd = w.wd = -1;
+    snprintf(w.path, sizeof(w.path), "%s", csv);
+    init_playlist(&got);
+    watch_sync(&w, &got, &added, &removed);
+    hm_free(&w.rows); hm_free(&w.row_key);
+    fuzz_expect("watch sync", &ref, &got, 1);
+    free_playlist(&got);
+
+    unlink(csv); unlink(bin); unlink(resaved);
+    free_playlist(&ref);
+    return 0;
+}
+#ifndef PLAYLIST_FUZZ_NO_MAIN
+/* Standalone and AFL driver: runs each file named on the command line, or stdin */
+int main(int argc, char **argv) {
+    for (int i = 1; i < argc || i == 1; ++i) {
+        const char *path = i < argc ? argv[i] : "/dev/stdin";
+        size_t len;
+        char *data = read_whole_file(path, &len);
+        if (!data) { perror(path); return 1; }
+        LLVMFuzzerTestOneInput((const unsigned char *)data, len);
+        free(data);
+    }
+    return 0;
+}
+#endif
+#define main playlist_main /* the interactive program is not the entry point */
+int main(int argc, char **argv);
+#endif
+
+int main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "--perfgate") == 0) return perf_gate(argc - 2, argv + 2);
+    if (argc > 1) { fprintf(stderr, "usage: %s [--perfgate BASELINE [--threshold PCT] [--runs N] [--tracks N] [--update]]\n", argv[0]); return 2; }
+    g_main_thread = pthread_self();
+    Playlist pl;
+    init_playlist(&pl);
+
+    /* try loading default file, then re-apply edits made since it was saved */
+    load_playlist(&pl, DEFAULT_SAVE);
+    size_t replayed = replay_journal(&pl, DEFAULT_JOURNAL);
+    place_strings(&pl);
+    PagedStore paged;
+    memset(&paged, 0, sizeof(paged));
+    SmartSet smart;
+    memset(&smart, 0, sizeof(smart));
+    pl.smart = &smart;
+    FileWatch watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.fd = watch.wd = -1;
+    AppendLog journal;
+    if (!log_open(&journal, DEFAULT_JOURNAL)) perror(DEFAULT_JOURNAL);
+    PlayHistory history;
+    if (!history_open(&history, DEFAULT_HISTORY, &pl)) perror(DEFAULT_HISTORY);
+    SimIndex sim;
+    memset(&sim, 0, sizeof(sim));
+
+    printf("Music Playlist Manager — simple and presentable\n");
+    printf("Type 'help' for commands. Starting with %zu tracks loaded.\n", pl.size);
+    if (replayed) printf("Recovered %zu unsaved edit(s) from %s.\n", replayed, DEFAULT_JOURNAL);
+
+    char cmdline[MAX_LINE], cmd_name[16] = "";
+    double cmd_t0 = 0, cmd_span = 0;
     while (1) {
+        /* the previous command is done once we are back at the prompt */
+        if (cmd_name[0]) {
+            double dt = now_sec() - cmd_t0 - g_input_wait;
+            hist_record(cmd_name, dt);
+            if (cmd_span) trace_span(cmd_name, cmd_span, now_sec(), -1);
+            TRACE2(cmd__done, cmd_name, (unsigned long long)(dt * 1e9));
+            if (compact_due(&pl)) printf("Auto-compacted: %zu KB reclaimed.\n", compact_playlist(&pl, &history) / 1024);
+        }
+        cmd_name[0] = '\0';
+        log_tick(&journal);
+        log_tick(&history.log);
+        watch_poll(&watch, &pl);
         printf("\n> ");
+        fflush(stdout);
+        log_wait_input(&journal, &history.log);
         if (!fgets(cmdline, sizeof(cmdline), stdin)) break;
+        cmd_t0 = now_sec();
+        cmd_span = atomic_load(&g_tracing) ? cmd_t0 : 0;
+        g_input_wait = 0;
+        watch_poll(&watch, &pl);
         size_t len = strlen(cmdline); if (len && cmdline[len-1] == '\n') cmdline[len-1] = '\0';
         trim(cmdline);
         if (cmdline[0] == '\0') continue;
@@ -299,6 +4627,10 @@ int main(void) {
         char *tokens = strdup_safe(cmdline);
         char *tok = strtok(tokens, " ");
         if (!tok) { free(tokens); continue; }
+        size_t cn = 0;
+        for (; tok[cn] && cn + 1 < sizeof(cmd_name); ++cn) cmd_name[cn] = (char)tolower((unsigned char)tok[cn]);
+        cmd_name[cn] = '\0';
+        TRACE1(cmd__start, cmd_name);
 
         if (strcasecmp(tok, "add") == 0) {
             char *title = read_input_line("Title: ");
@@ -310,59 +4642,399 @@ int main(void) {
             if (!artist) { artist = strdup_safe("Unknown"); }
             if (!album) { album = strdup_safe("Unknown"); }
             add_track(&pl, title, artist, album, dur);
+            journal_track(&journal, 'A', &pl.items[pl.size - 1]);
             printf("Added: %s — %s\n", title, artist);
             free(title); free(artist); free(album); free(dur_s);
         } else if (strcasecmp(tok, "list") == 0) {
-            list_playlist(&pl);
+            char *opt = strtok(NULL, " ");
+            SortKind kind = SORT_TITLE;
+            int sorted = 0, desc = 0, ok = 1;
+            size_t limit = SIZE_MAX;
+            for (; opt && ok; opt = strtok(NULL, " ")) {
+                char *arg = strcmp(opt, "--desc") ? strtok(NULL, " ") : NULL, *end = NULL;
+                if (strcmp(opt, "--desc") == 0) desc = 1;
+                else if (!arg) ok = 0;
+                else if (strcmp(opt, "--sorted-by") == 0) ok = sorted = parse_sort_kind(arg, &kind);
+                else if (strcmp(opt, "--limit") == 0) { limit = strtoul(arg, &end, 10); ok = !*end; }
+                else ok = 0;
+            }
+            if (!ok || ((desc || limit != SIZE_MAX) && !sorted)) puts("list [--sorted-by title|artist|dur [--limit N] [--desc]]");
+            else if (sorted) print_sorted_limit(&pl, kind, desc, limit);
+            else list_playlist(&pl);
         } else if (strcasecmp(tok, "remove") == 0) {
             char *n = strtok(NULL, " ");
             int idx = parse_index_token(n, (int)pl.size);
             if (idx < 0) printf("Invalid index. Usage: remove N (1..%zu)\n", pl.size);
-            else { remove_track_at(&pl, (size_t)idx); printf("Removed track %d.\n", idx+1); }
+            else {
+                journal_track(&journal, 'R', &pl.items[idx]);
+                remove_track_at(&pl, (size_t)idx);
+                printf("Removed track %d.\n", idx+1);
+            }
         } else if (strcasecmp(tok, "search") == 0) {
             char *term = strtok(NULL, "");
             if (!term) term = read_input_line("Search term: ");
             search_playlist(&pl, term);
             if (!strchr(cmdline, ' ')) free(term);
+        } else if (strcasecmp(tok, "filter") == 0) {
+            char *expr = strtok(NULL, "");
+            long hits = expr ? filter_playlist(&pl, expr) : -1;
+            if (hits < 0) puts("filter field<op>value ... (fields genre|year|track|rating|plays|last_played|path; ops = != ~ < <= > >=)");
+            else if (!hits) puts("No matches.");
+        } else if (strcasecmp(tok, "meta") == 0) {
+            char *n = strtok(NULL, " ");
+            char *sets = strtok(NULL, "");
+            int idx = parse_index_token(n, (int)pl.size);
+            if (idx < 0) { printf("Invalid index. Usage: meta N [field=value ...] (1..%zu)\n", pl.size); free(tokens); continue; }
+            Track *t = &pl.items[idx];
+            const char *s = sets ? sets : "";
+            int changed = 0;
+            for (;;) {
+                while (*s == ' ') s++;
+                if (!*s) break;
+                size_t flen = strcspn(s, "= ");
+                int f = meta_field_lookup(s, flen);
+                s += flen;
+                if (f < 0 || *s != '=') { printf("Expected field=value with field genre|year|track|rating|plays|last_played|path\n"); break; }
+                s++;
+                char *v = parse_rule_value(&s);
+                if (!v) { puts("Unclosed quote."); break; }
+                if (meta_set(&pl.meta, t->id, (MetaField)f, v)) changed = 1;
+                else printf("Bad value for %s: %s\n", meta_field_names[f], v);
+                free(v);
+            }
+            if (changed) journal_meta(&journal, &pl, t);
+            print_track(t, (size_t)idx);
+            char buf[32];
+            for (int f = 0; f < META_NFIELDS; ++f) {
+                const char *v = meta_text(&pl.meta, t->id, (MetaField)f, buf, sizeof(buf));
+                if (*v) printf("    %-12s %s\n", meta_field_names[f], v);
+            }
+        } else if (strcasecmp(tok, "sample") == 0) {
+            char *n = strtok(NULL, " ");
+            char *filter = strtok(NULL, "");
+            char *end = NULL;
+            unsigned long k = n ? strtoul(n, &end, 10) : 0;
+            if (!n || *end || !print_sample(&pl, &smart, k, filter))
+                puts("sample K [smart NAME | RULE] (RULE as for smart add, e.g. artist=Queen)");
+        } else if (strcasecmp(tok, "relayout") == 0) {
+            char *op = strtok(NULL, " ");
+            char *arg = strtok(NULL, " ");
+            if (!op) {
+                pack_strings(&pl);
+                printf("Strings of %zu tracks rewritten in playlist order (%zu KB).\n", pl.size, pl.blob_len / 1024);
+            } else if (strcasecmp(op, "auto") == 0 && arg && (strcasecmp(arg, "on") == 0 || strcasecmp(arg, "off") == 0)) {
+                g_relayout_on_load = strcasecmp(arg, "on") == 0;
+                printf("Relayout after load %s.\n", g_relayout_on_load ? "on" : "off");
+            } else puts("relayout | relayout auto on|off");
+        } else if (strcasecmp(tok, "memory") == 0) {
+            print_footprint(&pl);
+        } else if (strcasecmp(tok, "compact") == 0) {
+            char *op = strtok(NULL, " ");
+            char *arg = strtok(NULL, " ");
+            char *end = NULL;
+            long pct = arg ? strtol(arg, &end, 10) : -1;
+            if (!op) {
+                size_t n = pl.size;
+                size_t saved = compact_playlist(&pl, &history);
+                printf("Compacted %zu tracks: %zu KB reclaimed.\n", n, saved / 1024);
+            } else if (strcasecmp(op, "auto") == 0 && arg && strcasecmp(arg, "off") == 0) {
+                g_compact_auto = 0;
+                puts("Automatic compaction off.");
+            } else if (strcasecmp(op, "auto") == 0 && arg && !*end && pct > 0 && pct < 100) {
+                g_compact_auto = (int)pct;
+                printf("Compacting automatically above %d%% waste.\n", g_compact_auto);
+            } else puts("compact | compact auto PCT|off");
         } else if (strcasecmp(tok, "shuffle") == 0) {
             shuffle_playlist(&pl); printf("Playlist shuffled.\n");
         } else if (strcasecmp(tok, "sort") == 0) {
             char *kind = strtok(NULL, " ");
             if (!kind) { puts("sort title | artist | dur"); }
-            else if (strcasecmp(kind, "title") == 0) { qsort(pl.items, pl.size, sizeof(Track), cmp_title); puts("Sorted by title."); }
-            else if (strcasecmp(kind, "artist") == 0) { qsort(pl.items, pl.size, sizeof(Track), cmp_artist); puts("Sorted by artist."); }
-            else if (strcasecmp(kind, "dur") == 0 || strcasecmp(kind, "duration") == 0) { qsort(pl.items, pl.size, sizeof(Track), cmp_duration); puts("Sorted by duration."); }
+            else if (strcasecmp(kind, "title") == 0) { sort_playlist(&pl, SORT_TITLE); puts("Sorted by title."); }
+            else if (strcasecmp(kind, "artist") == 0) { sort_playlist(&pl, SORT_ARTIST); puts("Sorted by artist."); }
+            else if (strcasecmp(kind, "dur") == 0 || strcasecmp(kind, "duration") == 0) { sort_playlist(&pl, SORT_DURATION); puts("Sorted by duration."); }
             else printf("Unknown sort key '%s'. Use title|artist|dur\n", kind);
+        } else if (strcasecmp(tok, "extsort") == 0) {
+            char *kind = strtok(NULL, " ");
+            char *in = strtok(NULL, " ");
+            char *out = strtok(NULL, " ");
+            char *mb = strtok(NULL, " ");
+            int k = !kind ? -1 : strcasecmp(kind, "title") == 0 ? SORT_TITLE : strcasecmp(kind, "artist") == 0 ? SORT_ARTIST
+                  : (strcasecmp(kind, "dur") == 0 || strcasecmp(kind, "duration") == 0) ? SORT_DURATION : -1;
+            size_t budget = (size_t)(mb ? strtoul(mb, NULL, 10) : EXTSORT_DEFAULT_MB) << 20;
+            if (k < 0 || !in || !out || budget == 0) puts("extsort title|artist|dur IN OUT [MB]");
+            else {
+                size_t nruns = 0;
+                double t0 = now_sec();
+                long rows = extsort_csv(in, out, (SortKind)k, budget, &nruns);
+                if (rows < 0) printf("Failed to sort %s into %s\n", in, out);
+                else printf("Sorted %ld rows into %s (%zu run%s, %.2f s)\n", rows, out, nruns, nruns == 1 ? "" : "s", now_sec() - t0);
+            }
+        } else if (strcasecmp(tok, "union") == 0 || strcasecmp(tok, "intersect") == 0 || strcasecmp(tok, "diff") == 0) {
+            SetOp op = strcasecmp(tok, "union") == 0 ? SETOP_UNION : strcasecmp(tok, "intersect") == 0 ? SETOP_INTERSECT : SETOP_DIFF;
+            char *out = strtok(NULL, " ");
+            char *in[64];
+            size_t nin = 0;
+            for (char *a; nin < 64 && (a = strtok(NULL, " ")) != NULL;) in[nin++] = a;
+            if (!out || nin < 2) printf("%s OUT A B [C...]\n", tok);
+            else {
+                double t0 = now_sec();
+                long rows = setop_files(op, out, in, nin);
+                if (rows < 0) printf("Failed: could not read inputs or write %s\n", out);
+                else printf("Wrote %ld tracks to %s (%.2f s)\n", rows, out, now_sec() - t0);
+            }
+        } else if (strcasecmp(tok, "compare") == 0 || strcasecmp(tok, "merge") == 0) {
+            int merge = strcasecmp(tok, "merge") == 0;
+            char *f[4] = {NULL, NULL, NULL, NULL};
+            for (int i = 0; i < (merge ? 4 : 3); ++i) f[i] = strtok(NULL, " ");
+            Playlist v[3];
+            int nv = merge ? 3 : 2, ok = 1;
+            if (!f[1] || (merge && !f[3])) {
+                puts(merge ? "merge BASE OURS THEIRS OUT" : "compare OLD NEW [summary]");
+                free(tokens);
+                continue;
+            }
+            double t0 = now_sec();
+            for (int i = 0; i < nv; ++i) {
+                init_playlist(&v[i]);
+                if (!load_playlist(&v[i], f[i])) { printf("Failed to load %s\n", f[i]); ok = 0; }
+            }
+            if (ok && !merge) {
+                compare_playlists(&v[0], &v[1], f[2] && strcasecmp(f[2], "summary") == 0);
+                printf("(%.2f s)\n", now_sec() - t0);
+            } else if (ok) {
+                size_t added, dropped, conflicts;
+                long rows = merge_playlists(&v[0], &v[1], &v[2], f[3], &added, &dropped, &conflicts);
+                if (rows < 0) printf("Failed to write %s\n", f[3]);
+                else printf("Merged %ld tracks into %s: %zu added and %zu removed from theirs, %zu conflict(s) kept ours (%.2f s)\n",
+                            rows, f[3], added, dropped, conflicts, now_sec() - t0);
+            }
+            for (int i = 0; i < nv; ++i) free_playlist(&v[i]);
+        } else if (strcasecmp(tok, "paged") == 0) {
+            char *op = strtok(NULL, " ");
+            char *arg = strtok(NULL, "");
+            if (op && strcasecmp(op, "open") == 0) {
+                char *file = arg ? strtok(arg, " ") : NULL;
+                char *kb = file ? strtok(NULL, " ") : NULL;
+                char *dir = kb ? strtok(NULL, " ") : NULL;
+                size_t pool = (size_t)(kb ? strtoul(kb, NULL, 10) : PAGED_DEFAULT_KB) << 10;
+                if (!file) file = DEFAULT_SAVE;
+                paged_close(&paged);
+                if (paged_open(&paged, file, pool, dir)) printf("Opened %s paged: %zu tracks, %zu KB cache\n", file, paged.total, paged.nframes * PAGED_PAGE_SIZE >> 10);
+                else printf("Failed to open %s\n", file);
+            } else if (!paged.file) {
+                puts("No paged playlist open. Use: paged open FILE [KB [DIR]]");
+            } else if (op && strcasecmp(op, "list") == 0) {
+                if (!paged.total) puts("Playlist is empty.");
+                paged_each(&paged, paged_print_cb, NULL);
+            } else if (op && strcasecmp(op, "search") == 0 && arg) {
+                int found = 0;
+                void *ctx[2] = {arg, &found};
+                paged_each(&paged, paged_search_cb, ctx);
+                if (!found) printf("No matches for \"%s\".\n", arg);
+            } else if (op && (strcasecmp(op, "play") == 0 || strcasecmp(op, "remove") == 0)) {
+                int idx = parse_index_token(arg, paged.total > INT_MAX ? INT_MAX : (int)paged.total);
+                Track t;
+                if (idx < 0) printf("Invalid index. Usage: paged %s N (1..%zu)\n", op, paged.total);
+                else if (strcasecmp(op, "remove") == 0) { paged_remove(&paged, (size_t)idx); printf("Removed track %d.\n", idx + 1); }
+                else if (paged_get(&paged, (size_t)idx, &t)) play_track(&t);
+            } else if (op && strcasecmp(op, "save") == 0 && arg) {
+                char tmp[MAX_LINE + 32];
+                FILE *f = atomic_begin(arg, tmp);
+                if (f) fprintf(f, CSV_HEADER "\n"), paged_each(&paged, paged_save_cb, f);
+                if (f && atomic_finish(f, tmp, arg, 1)) printf("Saved to %s\n", arg); else printf("Failed to save to %s\n", arg);
+            } else if (op && strcasecmp(op, "stats") == 0) {
+                paged_stats(&paged);
+            } else if (op && strcasecmp(op, "close") == 0) {
+                paged_close(&paged);
+                puts("Paged playlist closed.");
+            } else {
+                puts("paged open F [KB [DIR]] | list | search X | play N | remove N | save F | stats | close");
+            }
         } else if (strcasecmp(tok, "play") == 0) {
             char *n = strtok(NULL, " ");
             int idx = parse_index_token(n, (int)pl.size);
             if (idx < 0) printf("Invalid index. Usage: play N (1..%zu)\n", pl.size);
-            else play_track(&pl.items[idx]);
+            else {
+                history_record(&history, &pl, &pl.items[idx]);
+                journal_meta(&journal, &pl, &pl.items[idx]);
+                play_track(&pl.items[idx]);
+            }
+        } else if (strcasecmp(tok, "recent") == 0 || strcasecmp(tok, "top") == 0) {
+            char *n = strtok(NULL, " ");
+            char *by = strtok(NULL, " ");
+            char *end = NULL;
+            size_t k = n ? strtoul(n, &end, 10) : 10;
+            int recent = strcasecmp(tok, "recent") == 0;
+            if ((n && *end) || (recent && by)) puts(recent ? "recent [K]" : "top [K] | top N by title|artist|dur [asc|desc]");
+            else if (recent) print_recent(&history, &pl, k);
+            else if (!by) print_top(&history, &pl, k);
+            else {
+                /* top N by KEY [asc|desc]: longest first for dur, else A-Z */
+                char *key = strcasecmp(by, "by") == 0 ? strtok(NULL, " ") : NULL;
+                char *dir = strtok(NULL, " ");
+                SortKind kind;
+                if (!key || !parse_sort_kind(key, &kind) || (dir && strcasecmp(dir, "asc") && strcasecmp(dir, "desc")))
+                    puts("top [K] | top N by title|artist|dur [asc|desc]");
+                else print_sorted_limit(&pl, kind, dir ? strcasecmp(dir, "desc") == 0 : kind == SORT_DURATION, k);
+            }
+        } else if (strcasecmp(tok, "similar") == 0) {
+            char *n = strtok(NULL, " ");
+            char *k = strtok(NULL, " ");
+            int idx = parse_index_token(n, (int)pl.size);
+            if (idx < 0) printf("Invalid index. Usage: similar N [K] (1..%zu)\n", pl.size);
+            else {
+                if (!pl.sim) { sim_build(&sim, &pl); pl.sim = &sim; } /* first use; kept current after */
+                print_similar(&sim, &pl, (size_t)idx, k ? strtoul(k, NULL, 10) : 10);
+            }
         } else if (strcasecmp(tok, "save") == 0) {
             char *file = strtok(NULL, " ");
             if (!file) file = DEFAULT_SAVE;
-            if (save_playlist_csv(&pl, file)) printf("Saved to %s\n", file); else printf("Failed to save to %s\n", file);
+            if (save_playlist(&pl, file)) {
+                size_t a, r;
+                if (strcmp(file, DEFAULT_SAVE) == 0) log_reset(&journal);
+                if (watch.fd >= 0 && strcmp(file, watch.path) == 0) watch_sync(&watch, NULL, &a, &r); /* our own write */
+                printf("Saved to %s\n", file);
+            } else printf("Failed to save to %s\n", file);
         } else if (strcasecmp(tok, "load") == 0) {
             char *file = strtok(NULL, " ");
             if (!file) file = DEFAULT_SAVE;
-            if (load_playlist_csv(&pl, file)) printf("Loaded (appended) from %s\n", file); else printf("Failed to load from %s\n", file);
+            if (load_playlist(&pl, file)) {
+                char rec[MAX_LINE + 2];
+                snprintf(rec, sizeof(rec), "L,%s", file);
+                journal_line(&journal, rec);
+                place_strings(&pl);
+                printf("Loaded (appended) from %s\n", file);
+            }
+            else printf("Failed to load from %s\n", file);
+        } else if (strcasecmp(tok, "publish") == 0) {
+            char *name = strtok(NULL, " ");
+            unsigned long long gen = 0;
+            if (!name) name = DEFAULT_SHM;
+            if (publish_playlist_shm(&pl, name, &gen)) printf("Published %zu tracks to /%s (version %llu)\n", pl.size, name, gen);
+            else printf("Failed to publish to /%s\n", name);
+        } else if (strcasecmp(tok, "peek") == 0) {
+            char *name = strtok(NULL, " ");
+            char *op = strtok(NULL, " ");
+            char *title = strtok(NULL, "");
+            ShmView v;
+            if (!name) name = DEFAULT_SHM;
+            if (!shm_view_open(&v, name)) { printf("No published playlist /%s\n", name); }
+            else {
+                printf("/%s version %llu: %llu tracks\n", name, v.hdr->generation, v.hdr->count);
+                if (op && strcasecmp(op, "find") == 0 && title) {
+                    long idx = shm_view_find_title(&v, title);
+                    if (idx < 0) printf("No track titled \"%s\".\n", title);
+                    else { Track t = shm_view_track(&v, (size_t)idx); print_track(&t, (size_t)idx); }
+                } else {
+                    for (size_t i = 0; i < v.hdr->count; ++i) { Track t = shm_view_track(&v, i); print_track(&t, i); }
+                }
+                shm_view_close(&v);
+            }
         } else if (strcasecmp(tok, "clear") == 0) {
-            for (size_t i = 0; i < pl.size; ++i) free_track(&pl.items[i]);
-            pl.size = 0; puts("Playlist cleared.");
+            clear_playlist(&pl);
+            journal_line(&journal, "C"); puts("Playlist cleared.");
+        } else if (strcasecmp(tok, "smart") == 0) {
+            char *op = strtok(NULL, " ");
+            char *name = strtok(NULL, " ");
+            char *rule = strtok(NULL, "");
+            if (!op || strcasecmp(op, "list") == 0) {
+                if (!smart.n) puts("No smart playlists.");
+                for (size_t i = 0; i < smart.n; ++i)
+                    printf(" %-16s %6zu tracks  %s\n", smart.rules[i].name, smart.rules[i].members.n, smart.rules[i].source);
+            } else if (strcasecmp(op, "add") == 0 && name && rule) {
+                SmartPlaylist *sp = smart_define(&smart, &pl, name, rule);
+                if (sp) printf("Smart playlist %s: %zu tracks\n", sp->name, sp->members.n);
+                else printf("Cannot add %s: name in use or bad rule (fields title|artist|album|dur)\n", name);
+            } else if (strcasecmp(op, "show") == 0 && name) {
+                SmartPlaylist *sp = smart_find(&smart, name);
+                if (!sp) printf("No smart playlist %s\n", name);
+                else if (!sp->members.n) puts("Playlist is empty.");
+                else for (size_t i = 0; i < pl.size; ++i)
+                    if (idset_has(&sp->members, pl.items[i].id)) print_track(&pl.items[i], i);
+            } else if (strcasecmp(op, "del") == 0 && name) {
+                if (smart_delete(&smart, name)) printf("Deleted smart playlist %s\n", name);
+                else printf("No smart playlist %s\n", name);
+            } else {
+                puts("smart add NAME RULE | smart list | smart show NAME | smart del NAME");
+            }
+        } else if (strcasecmp(tok, "watch") == 0) {
+            char *file = strtok(NULL, " ");
+            if (file && strcasecmp(file, "off") == 0) { watch_stop(&watch); puts("Stopped watching."); }
+            else {
+                if (!file) file = DEFAULT_SAVE;
+                if (watch_start(&watch, file)) printf("Watching %s for changes.\n", file);
+                else printf("Cannot watch %s (missing file, or not supported here).\n", file);
+            }
+        } else if (strcasecmp(tok, "fsync") == 0) {
+            char *mode = strtok(NULL, " ");
+            int found = -1;
+            for (int i = 0; mode && i < 3; ++i) if (strcasecmp(mode, fsync_policy_names[i]) == 0) found = i;
+            if (found >= 0) { log_commit(&journal); g_fsync_policy = (FsyncPolicy)found; }
+            else if (mode) printf("Unknown policy '%s'. ", mode);
+            printf("fsync policy: %s\n", fsync_policy_names[g_fsync_policy]);
+        } else if (strcasecmp(tok, "bench") == 0) {
+            char *kind = strtok(NULL, " ");
+            char *n = strtok(NULL, " ");
+            size_t count = n ? strtoul(n, NULL, 10) : 1000000;
+            if (count == 0) count = 1;
+            if (kind && strcasecmp(kind, "scan") == 0) bench_scan(count);
+            else if (kind && strcasecmp(kind, "prefetch") == 0) bench_prefetch(count);
+            else if (kind && strcasecmp(kind, "fsync") == 0) bench_fsync(count);
+            else if (kind && strcasecmp(kind, "extsort") == 0) bench_extsort(count);
+            else if (kind && strcasecmp(kind, "similar") == 0) bench_similar(count);
+            else if (kind && strcasecmp(kind, "relayout") == 0) bench_relayout(count);
+            else if (kind && strcasecmp(kind, "sort") == 0) bench_sort(count);
+            else puts("bench scan|prefetch|fsync|extsort|similar|relayout|sort [N]");
+        } else if (strcasecmp(tok, "latency") == 0) {
+            char *op = strtok(NULL, " ");
+            char *file = strtok(NULL, " ");
+            if (!op) print_latency();
+            else if (strcasecmp(op, "reset") == 0) { free_latency(); puts("Latency histograms cleared."); }
+            else if (strcasecmp(op, "dump") == 0 && file) {
+                if (dump_latency(file)) printf("Wrote latency histograms to %s\n", file);
+                else printf("Failed to write %s\n", file);
+            } else puts("latency | latency dump FILE | latency reset");
+        } else if (strcasecmp(tok, "trace") == 0) {
+            char *op = strtok(NULL, " ");
+            char *file = strtok(NULL, " ");
+            if (!op) printf("Tracing is %s; %zu span(s) recorded.\n", atomic_load(&g_tracing) ? "on" : "off", trace_count());
+            else if (strcasecmp(op, "on") == 0) { trace_start(); puts("Tracing on (previous spans cleared)."); }
+            else if (strcasecmp(op, "off") == 0) { atomic_store(&g_tracing, 0); printf("Tracing off; %zu span(s) kept.\n", trace_count()); }
+            else if (strcasecmp(op, "dump") == 0) {
+                if (!file) file = DEFAULT_TRACE;
+                if (trace_dump(file)) printf("Wrote %zu trace span(s) to %s\n", trace_count(), file);
+                else printf("Failed to write %s\n", file);
+            } else puts("trace | trace on | trace off | trace dump [FILE]");
         } else if (strcasecmp(tok, "help") == 0) {
             print_help();
         } else if (strcasecmp(tok, "quit") == 0 || strcasecmp(tok, "exit") == 0) {
-            save_playlist_csv(&pl, DEFAULT_SAVE);
-            printf("Saved to %s. Bye!\n", DEFAULT_SAVE);
+            if (save_playlist(&pl, DEFAULT_SAVE)) {
+                log_reset(&journal);
+                printf("Saved to %s. Bye!\n", DEFAULT_SAVE);
+            } else printf("Failed to save to %s; edits kept in %s. Bye!\n", DEFAULT_SAVE, DEFAULT_JOURNAL);
             free(tokens);
             break;
         } else {
             printf("Unknown command: %s. Type 'help' for commands.\n", tok);
+            strcpy(cmd_name, "(unknown)");
         }
 
         free(tokens);
     }
 
+    if (trace_count()) {
+        if (trace_dump(DEFAULT_TRACE)) printf("Wrote %zu trace span(s) to %s\n", trace_count(), DEFAULT_TRACE);
+        else perror(DEFAULT_TRACE);
+    }
+    free_latency();
+    log_close(&journal);
+    history_close(&history);
+    watch_stop(&watch);
+    paged_close(&paged);
+    pl.smart = NULL;
+    smart_free(&smart);
+    pl.sim = NULL;
+    sim_free(&sim);
     free_playlist(&pl);
     return 0;
 }